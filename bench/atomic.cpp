@@ -0,0 +1,57 @@
+#include "bench.h"
+
+#include "shared-from-this/atomic_shared.h"
+
+#include <memory>
+#include <mutex>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Readers loading a published pointer on every request, as with a configuration or routing table
+// that is replaced once in a while.
+
+namespace {
+
+constexpr size_t kIterations = 1'000'000;
+
+struct Table {
+    int routes[16] = {};
+};
+
+class MutexSharedPtr {
+public:
+    explicit MutexSharedPtr(SharedPtr<Table> table) : table_(std::move(table)) {
+    }
+
+    SharedPtr<Table> Load() const {
+        std::lock_guard guard(mutex_);
+        return table_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    SharedPtr<Table> table_;
+};
+
+template <typename Load>
+double LoadNs(size_t threads, Load load) {
+    return MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            auto table = load();
+            DoNotOptimize(table->routes[0]);
+        }
+    });
+}
+
+}  // namespace
+
+BENCHMARK(AtomicSharedPtr) {
+    AtomicSharedPtr<Table> atomic(MakeShared<Table>());
+    MutexSharedPtr guarded(MakeShared<Table>());
+    std::atomic<std::shared_ptr<Table>> std_atomic(std::make_shared<Table>());
+    for (size_t threads : ThreadCounts()) {
+        Report("AtomicSharedPtr::Load", threads, LoadNs(threads, [&] { return atomic.Load(); }));
+        Report("mutex + SharedPtr", threads, LoadNs(threads, [&] { return guarded.Load(); }));
+        Report("std::atomic<std::shared_ptr>::load", threads,
+               LoadNs(threads, [&] { return std_atomic.load(); }));
+    }
+}
@@ -0,0 +1,69 @@
+#include "bench.h"
+
+#include "shared-from-this/batch.h"
+
+#include <array>
+#include <memory>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Fan-out dispatch: every thread delivers the same few messages to many subscribers, each of
+// which takes its own reference and drops it when done. Without a batch that is two atomic
+// read-modify-writes on a shared cache line per delivery; with one scope per round of messages it
+// is one fetch_add and one fetch_sub per message and round.
+
+namespace {
+
+constexpr size_t kIterations = 20'000;
+constexpr size_t kMessages = 4;
+constexpr size_t kSubscribers = 16;
+
+struct Message {
+    int payload[8] = {};
+};
+
+template <typename Ptr>
+[[gnu::noinline]] void Deliver(Ptr message) {
+    DoNotOptimize(message->payload[0]);
+}
+
+template <typename Ptr>
+void DispatchRound(const std::array<Ptr, kMessages>& messages) {
+    for (const auto& message : messages) {
+        for (size_t subscriber = 0; subscriber < kSubscribers; ++subscriber) {
+            Deliver(message);
+        }
+    }
+}
+
+// Nanoseconds per delivery.
+template <bool kBatched, typename Ptr>
+double DispatchNs(size_t threads, const std::array<Ptr, kMessages>& messages) {
+    double round_ns = MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            if constexpr (kBatched) {
+                RefcountBatchScope scope;
+                DispatchRound(messages);
+            } else {
+                DispatchRound(messages);
+            }
+        }
+    });
+    return round_ns / (kMessages * kSubscribers);
+}
+
+}  // namespace
+
+BENCHMARK(RefcountBatch) {
+    std::array<SharedPtr<Message>, kMessages> messages;
+    std::array<std::shared_ptr<Message>, kMessages> std_messages;
+    for (size_t i = 0; i < kMessages; ++i) {
+        messages[i] = MakeShared<Message>();
+        std_messages[i] = std::make_shared<Message>();
+    }
+    for (size_t threads : ThreadCounts()) {
+        Report("fan-out SharedPtr", threads, DispatchNs<false>(threads, messages));
+        Report("fan-out SharedPtr, RefcountBatchScope", threads,
+               DispatchNs<true>(threads, messages));
+        Report("fan-out std::shared_ptr", threads, DispatchNs<false>(threads, std_messages));
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A tiny self-contained benchmark harness. `BENCHMARK(Name) { ... }` registers a function that
+// `main` runs once; it times its loops with `MeasureNsPerOp` and publishes results with `Report`.
+// main.cpp replaces the global `operator new` to count allocations, and every result carries the
+// allocations per iteration of the measurement before it.
+
+using BenchmarkFunction = void (*)();
+
+bool RegisterBenchmark(const char* name, BenchmarkFunction function);
+
+void Report(const std::string& name, size_t threads, double ns_per_op);
+
+// Allocations made by the calling thread so far.
+size_t ThreadAllocations();
+
+// Attributes `allocations` over `iterations` to the next `Report`.
+void RecordAllocations(size_t allocations, size_t iterations);
+
+#define BENCHMARK(name)                                               \
+    static void Benchmark##name();                                    \
+    [[maybe_unused]] static const bool kBenchmark##name##Registered = \
+        RegisterBenchmark(#name, Benchmark##name);                    \
+    static void Benchmark##name()
+
+// Keeps the compiler from optimizing away a value.
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// 1, 2, 4, ... up to the number of hardware threads (and at least 2, so that contention is
+// always measured).
+inline std::vector<size_t> ThreadCounts() {
+    size_t max_threads = std::max<size_t>(2, std::thread::hardware_concurrency());
+    std::vector<size_t> counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(max_threads);
+    return counts;
+}
+
+// Starts `threads` threads at the same moment, lets each run `body(thread_index, iterations)`
+// and returns the wall-clock nanoseconds per iteration of a single thread: perfect scaling keeps
+// this number flat as `threads` grows. Allocations are counted over all threads.
+template <typename Body>
+double MeasureNsPerOp(size_t threads, size_t iterations, Body&& body) {
+    std::atomic<size_t> ready = 0;
+    std::atomic<bool> start = false;
+    std::atomic<size_t> allocations = 0;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&, i] {
+            ready.fetch_add(1);
+            while (!start.load(std::memory_order_acquire)) {
+            }
+            size_t before = ThreadAllocations();
+            body(i, iterations);
+            allocations.fetch_add(ThreadAllocations() - before);
+        });
+    }
+    while (ready.load() != threads) {
+        std::this_thread::yield();
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+    RecordAllocations(allocations.load(), threads * iterations);
+    return elapsed.count() / static_cast<double>(iterations);
+}
@@ -0,0 +1,58 @@
+#include "bench.h"
+
+#include "shared-from-this/shared.h"
+#include "shared-from-this/biased.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Biased counting pays off when the owner thread does almost all of the counting, and falls back
+// to atomics (plus a branch) when the references are spread evenly over threads.
+
+namespace {
+
+constexpr size_t kIterations = 1'000'000;
+
+template <typename Counting>
+void CopyLoop(const SharedPtr<int, Counting>& shared, size_t iterations) {
+    for (size_t i = 0; i < iterations; ++i) {
+        SharedPtr<int, Counting> copy = shared;
+        DoNotOptimize(copy);
+    }
+}
+
+// Thread 0 creates the object and does the bulk of the copies; the others touch it once in a
+// while.
+template <typename Counting>
+double OwnerHeavy(size_t threads) {
+    SharedPtr<int, Counting> shared;
+    std::atomic<bool> ready = false;
+    return MeasureNsPerOp(threads, kIterations, [&](size_t index, size_t iterations) {
+        if (index == 0) {
+            shared = MakeShared<int, Counting>(42);
+            ready.store(true, std::memory_order_release);
+            CopyLoop(shared, iterations);
+            return;
+        }
+        while (!ready.load(std::memory_order_acquire)) {
+        }
+        CopyLoop(shared, iterations / 100);
+    });
+}
+
+template <typename Counting>
+double EvenlyShared(size_t threads) {
+    auto shared = MakeShared<int, Counting>(42);
+    return MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+        CopyLoop(shared, iterations);
+    });
+}
+
+}  // namespace
+
+BENCHMARK(BiasedCounting) {
+    for (size_t threads : ThreadCounts()) {
+        Report("AtomicCounting owner-heavy", threads, OwnerHeavy<AtomicCounting>(threads));
+        Report("BiasedCounting owner-heavy", threads, OwnerHeavy<BiasedCounting>(threads));
+        Report("AtomicCounting evenly shared", threads, EvenlyShared<AtomicCounting>(threads));
+        Report("BiasedCounting evenly shared", threads, EvenlyShared<BiasedCounting>(threads));
+    }
+}
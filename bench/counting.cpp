@@ -0,0 +1,69 @@
+#include "bench.h"
+
+#include "shared-from-this/shared.h"
+#include "shared-from-this/weak.h"
+
+#include <memory>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Single-threaded cost of each counting policy: copies go into a batch, then the batch is
+// destroyed, so both halves are timed separately.
+
+namespace {
+
+constexpr size_t kBatch = 1024;
+constexpr size_t kRounds = 1000;
+
+template <typename Shared>
+void BenchCopyDestroy(const std::string& name, const Shared& shared) {
+    std::vector<Shared> copies;
+    copies.reserve(kBatch);
+    std::chrono::duration<double, std::nano> copy{0};
+    std::chrono::duration<double, std::nano> destroy{0};
+    for (size_t round = 0; round < kRounds; ++round) {
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < kBatch; ++i) {
+            copies.push_back(shared);
+        }
+        auto middle = std::chrono::steady_clock::now();
+        copies.clear();
+        auto end = std::chrono::steady_clock::now();
+        copy += middle - begin;
+        destroy += end - middle;
+    }
+    Report(name + " copy", 1, copy.count() / (kRounds * kBatch));
+    Report(name + " destroy", 1, destroy.count() / (kRounds * kBatch));
+}
+
+template <typename Weak>
+void BenchLock(const std::string& name, const Weak& weak) {
+    Report(name + " Lock", 1, MeasureNsPerOp(1, kRounds * kBatch, [&](size_t, size_t iterations) {
+               for (size_t i = 0; i < iterations; ++i) {
+                   auto locked = weak.Lock();
+                   DoNotOptimize(locked);
+               }
+           }));
+}
+
+}  // namespace
+
+BENCHMARK(CountingPolicies) {
+    auto shared = MakeShared<int>(42);
+    BenchCopyDestroy("AtomicCounting", shared);
+    BenchLock("AtomicCounting", WeakPtr<int>(shared));
+
+    auto local = MakeLocalShared<int>(42);
+    BenchCopyDestroy("LocalCounting", local);
+    BenchLock("LocalCounting", LocalWeakPtr<int>(local));
+
+    auto std_shared = std::make_shared<int>(42);
+    BenchCopyDestroy("std::shared_ptr", std_shared);
+    Report("std::shared_ptr Lock", 1,
+           MeasureNsPerOp(1, kRounds * kBatch, [weak = std::weak_ptr<int>(std_shared)](
+                                                   size_t, size_t iterations) {
+               for (size_t i = 0; i < iterations; ++i) {
+                   auto locked = weak.lock();
+                   DoNotOptimize(locked);
+               }
+           }));
+}
@@ -0,0 +1,48 @@
+#include "bench.h"
+
+#include "shared-from-this/hazard.h"
+
+#include <memory>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Reading a shared object from every thread: a counted copy writes to the control block on every
+// read, a hazard-pointer borrow only writes to a slot owned by the reader.
+
+namespace {
+
+constexpr size_t kIterations = 1'000'000;
+
+struct Table {
+    int routes[16] = {};
+};
+
+template <typename Read>
+double ReadNs(size_t threads, Read read) {
+    return MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            read();
+        }
+    });
+}
+
+}  // namespace
+
+BENCHMARK(HazardPointers) {
+    auto shared = MakeShared<Table>();
+    auto std_shared = std::make_shared<Table>();
+    HazardCell<Table> cell(MakeShared<Table>());
+    for (size_t threads : ThreadCounts()) {
+        Report("HazardCell::Borrow", threads, ReadNs(threads, [&] {
+                   auto guard = cell.Borrow();
+                   DoNotOptimize(guard->routes[0]);
+               }));
+        Report("SharedPtr copy", threads, ReadNs(threads, [&] {
+                   SharedPtr<Table> copy = shared;
+                   DoNotOptimize(copy->routes[0]);
+               }));
+        Report("std::shared_ptr copy", threads, ReadNs(threads, [&] {
+                   std::shared_ptr<Table> copy = std_shared;
+                   DoNotOptimize(copy->routes[0]);
+               }));
+    }
+}
@@ -0,0 +1,62 @@
+#include "bench.h"
+
+#include "intrusive/intrusive.h"
+#include "shared-from-this/shared.h"
+
+#include <memory>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// `IntrusivePtr` over `ThreadSafeRefCounted` against `SharedPtr`: the count lives in the object
+// instead of a control block, and the pointer is one word instead of two.
+
+namespace {
+
+constexpr size_t kIterations = 1'000'000;
+
+struct Node : ThreadSafeRefCounted<Node> {
+    int value = 42;
+};
+
+template <typename Ptr>
+double CopyNs(size_t threads, const Ptr& shared) {
+    return MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            Ptr copy = shared;
+            DoNotOptimize(copy);
+        }
+    });
+}
+
+template <typename Make>
+double CreateReleaseNs(size_t threads, Make make) {
+    return MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            auto ptr = make();
+            DoNotOptimize(ptr);
+        }
+    });
+}
+
+}  // namespace
+
+BENCHMARK(IntrusiveCopyContended) {
+    auto intrusive = MakeIntrusive<Node>();
+    auto shared = MakeShared<Node>();
+    auto std_shared = std::make_shared<Node>();
+    for (size_t threads : ThreadCounts()) {
+        Report("IntrusivePtr copy+destroy", threads, CopyNs(threads, intrusive));
+        Report("SharedPtr copy+destroy", threads, CopyNs(threads, shared));
+        Report("std::shared_ptr copy+destroy", threads, CopyNs(threads, std_shared));
+    }
+}
+
+BENCHMARK(IntrusiveCreateRelease) {
+    for (size_t threads : ThreadCounts()) {
+        Report("MakeIntrusive + release", threads,
+               CreateReleaseNs(threads, [] { return MakeIntrusive<Node>(); }));
+        Report("MakeShared + release", threads,
+               CreateReleaseNs(threads, [] { return MakeShared<Node>(); }));
+        Report("std::make_shared + release", threads,
+               CreateReleaseNs(threads, [] { return std::make_shared<Node>(); }));
+    }
+}
@@ -0,0 +1,161 @@
+#include "bench.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace {
+
+struct Benchmark {
+    const char* name;
+    BenchmarkFunction function;
+};
+
+std::vector<Benchmark>& Benchmarks() {
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+struct Result {
+    std::string name;
+    size_t threads;
+    double ns_per_op;
+    std::optional<double> allocations_per_op;
+};
+
+bool json_output = false;
+std::vector<Result> results;
+// Set by `RecordAllocations`, taken by the next `Report`: results timed by hand have none.
+std::optional<double> pending_allocations_per_op;
+
+thread_local size_t thread_allocations = 0;
+
+void* CountedAllocate(size_t size) {
+    ++thread_allocations;
+    if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void* CountedAllocate(size_t size, std::align_val_t alignment) {
+    ++thread_allocations;
+    auto align = static_cast<size_t>(alignment);
+    if (void* memory = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void PrintJsonString(const std::string& text) {
+    std::putchar('"');
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            std::putchar('\\');
+        }
+        std::putchar(c);
+    }
+    std::putchar('"');
+}
+
+void PrintJson() {
+    std::printf("[\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        std::printf("  {\"name\": ");
+        PrintJsonString(result.name);
+        std::printf(", \"threads\": %zu, \"ns_per_op\": %.3f, \"allocs_per_op\": ",
+                    result.threads, result.ns_per_op);
+        if (result.allocations_per_op) {
+            std::printf("%.3f}", *result.allocations_per_op);
+        } else {
+            std::printf("null}");
+        }
+        std::printf(i + 1 < results.size() ? ",\n" : "\n");
+    }
+    std::printf("]\n");
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+    return CountedAllocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return CountedAllocate(size, alignment);
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+bool RegisterBenchmark(const char* name, BenchmarkFunction function) {
+    Benchmarks().push_back({name, function});
+    return true;
+}
+
+size_t ThreadAllocations() {
+    return thread_allocations;
+}
+
+void RecordAllocations(size_t allocations, size_t iterations) {
+    pending_allocations_per_op = static_cast<double>(allocations) / static_cast<double>(iterations);
+}
+
+void Report(const std::string& name, size_t threads, double ns_per_op) {
+    auto allocations_per_op = std::exchange(pending_allocations_per_op, std::nullopt);
+    if (json_output) {
+        results.push_back({name, threads, ns_per_op, allocations_per_op});
+    } else if (allocations_per_op) {
+        std::printf("%-48s %3zu threads %10.2f ns/op %8.3f allocs/op\n", name.c_str(), threads,
+                    ns_per_op, *allocations_per_op);
+    } else {
+        std::printf("%-48s %3zu threads %10.2f ns/op\n", name.c_str(), threads, ns_per_op);
+    }
+}
+
+// Usage: bench_smart_ptrs [--json] [substring]
+// Runs every benchmark whose name contains `substring` (all of them by default). With `--json`
+// the results are printed at the end as an array of
+// {"name", "threads", "ns_per_op", "allocs_per_op"} objects instead, `allocs_per_op` being null
+// for the benchmarks that time their loops by hand.
+int main(int argc, char** argv) {
+    // libstdc++ skips the atomic instructions of `std::shared_ptr` until the process starts its
+    // first thread, which would make the single-threaded baselines unfair.
+    std::thread([] {}).join();
+
+    const char* filter = "";
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--json") == 0) {
+            json_output = true;
+        } else {
+            filter = argv[i];
+        }
+    }
+    for (const auto& benchmark : Benchmarks()) {
+        if (std::strstr(benchmark.name, filter) != nullptr) {
+            benchmark.function();
+        }
+    }
+    if (json_output) {
+        PrintJson();
+    }
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include "bench.h"
+
+#include "shared-from-this/shared.h"
+#include "unique/unique.h"
+
+#include <cstring>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Large buffers made only to be filled right away, the way I/O code makes them. The value-
+// initializing factories zero every byte before the fill writes it again; the `...ForOverwrite`
+// ones leave the storage as allocated, so the difference is one pass over the buffer's memory.
+
+namespace {
+
+// Bytes every thread makes and fills per measurement.
+constexpr size_t kBytesPerThread = size_t{1} << 30;
+
+template <typename Make>
+double MakeAndFillNs(size_t threads, size_t size, Make make) {
+    return MeasureNsPerOp(threads, kBytesPerThread / size, [&](size_t, size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            auto buffer = make(size);
+            std::memset(buffer.Get(), 1, size);
+            DoNotOptimize(buffer.Get()[size - 1]);
+        }
+    });
+}
+
+std::string SizeName(size_t size) {
+    return size >= (1 << 20) ? std::to_string(size >> 20) + " MiB"
+                             : std::to_string(size >> 10) + " KiB";
+}
+
+}  // namespace
+
+BENCHMARK(ForOverwrite) {
+    for (size_t threads : {size_t{1}, ThreadCounts().back()}) {
+        for (size_t size : {size_t{64} << 10, size_t{1} << 20, size_t{16} << 20}) {
+            std::string suffix = "(";
+            suffix.append(SizeName(size)).append(")+fill");
+            Report("MakeUnique<char[]>" + suffix, threads,
+                   MakeAndFillNs(threads, size, [](size_t n) { return MakeUnique<char[]>(n); }));
+            Report("MakeUniqueForOverwrite<char[]>" + suffix, threads,
+                   MakeAndFillNs(threads, size,
+                                 [](size_t n) { return MakeUniqueForOverwrite<char[]>(n); }));
+            Report("MakeShared<char[]>" + suffix, threads,
+                   MakeAndFillNs(threads, size, [](size_t n) { return MakeShared<char[]>(n); }));
+            Report("MakeSharedForOverwrite<char[]>" + suffix, threads,
+                   MakeAndFillNs(threads, size,
+                                 [](size_t n) { return MakeSharedForOverwrite<char[]>(n); }));
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#include "bench.h"
+
+#include "intrusive/object_pool.h"
+#include "shared-from-this/shared.h"
+
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// High allocation rates: every thread allocates short-lived messages, either one at a time or in
+// bursts that are released together, from a shared `ObjectPool` or the heap.
+
+namespace {
+
+constexpr size_t kIterations = 1'000'000;
+constexpr size_t kBurst = 256;
+
+struct PooledMessage : ObjectInPool<PooledMessage> {
+    char payload[64] = {};
+};
+
+struct IntrusiveMessage : ThreadSafeRefCounted<IntrusiveMessage> {
+    char payload[64] = {};
+};
+
+struct Message {
+    char payload[64] = {};
+};
+
+template <typename Make>
+double SteadyNs(size_t threads, Make make) {
+    return MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            auto message = make();
+            DoNotOptimize(message->payload[0]);
+        }
+    });
+}
+
+template <typename Make>
+double BurstNs(size_t threads, Make make) {
+    using Ptr = decltype(make());
+    return MeasureNsPerOp(threads, kIterations / kBurst, [&](size_t, size_t iterations) {
+        std::vector<Ptr> messages;
+        messages.reserve(kBurst);
+        for (size_t i = 0; i < iterations; ++i) {
+            for (size_t j = 0; j < kBurst; ++j) {
+                messages.push_back(make());
+            }
+            messages.clear();
+        }
+    }) / kBurst;
+}
+
+}  // namespace
+
+BENCHMARK(ObjectPool) {
+    ObjectPool<PooledMessage> pool;
+    pool.Prewarm(kBurst * 16);
+    for (size_t threads : ThreadCounts()) {
+        Report("ObjectPool::Allocate", threads, SteadyNs(threads, [&] { return pool.Allocate(); }));
+        Report("MakeIntrusive", threads,
+               SteadyNs(threads, [] { return MakeIntrusive<IntrusiveMessage>(); }));
+        Report("MakeShared", threads, SteadyNs(threads, [] { return MakeShared<Message>(); }));
+    }
+    for (size_t threads : ThreadCounts()) {
+        Report("ObjectPool::Allocate burst", threads,
+               BurstNs(threads, [&] { return pool.Allocate(); }));
+        Report("MakeIntrusive burst", threads,
+               BurstNs(threads, [] { return MakeIntrusive<IntrusiveMessage>(); }));
+        Report("MakeShared burst", threads, BurstNs(threads, [] { return MakeShared<Message>(); }));
+    }
+}
@@ -0,0 +1,89 @@
+#include "bench.h"
+
+#include "shared-from-this/shared.h"
+#include "shared-from-this/weak.h"
+
+#include <memory>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Cost of the last release alone: a batch of owners is created untimed, then destroyed timed.
+// `int` is trivially destructible, so its block skips the destroy call altogether.
+
+namespace {
+
+constexpr size_t kBatch = 1024;
+constexpr size_t kRounds = 1000;
+
+template <typename Make>
+double ReleaseNs(Make make) {
+    using Ptr = decltype(make());
+    std::vector<Ptr> owners;
+    owners.reserve(kBatch);
+    std::chrono::duration<double, std::nano> elapsed{0};
+    for (size_t round = 0; round < kRounds; ++round) {
+        for (size_t i = 0; i < kBatch; ++i) {
+            owners.push_back(make());
+        }
+        auto begin = std::chrono::steady_clock::now();
+        owners.clear();
+        elapsed += std::chrono::steady_clock::now() - begin;
+    }
+    return elapsed.count() / (kRounds * kBatch);
+}
+
+// Same, but every owner comes with a weak reference that is dropped afterwards, untimed: the last
+// strong release destroys the object and leaves the block to the weak one.
+template <typename Make, typename MakeWeak>
+double ReleaseWithWeakNs(Make make, MakeWeak make_weak) {
+    using Ptr = decltype(make());
+    using Weak = decltype(make_weak(make()));
+    std::vector<Ptr> owners;
+    std::vector<Weak> weaks;
+    owners.reserve(kBatch);
+    weaks.reserve(kBatch);
+    std::chrono::duration<double, std::nano> elapsed{0};
+    for (size_t round = 0; round < kRounds; ++round) {
+        for (size_t i = 0; i < kBatch; ++i) {
+            owners.push_back(make());
+            weaks.push_back(make_weak(owners.back()));
+        }
+        auto begin = std::chrono::steady_clock::now();
+        owners.clear();
+        elapsed += std::chrono::steady_clock::now() - begin;
+        weaks.clear();
+    }
+    return elapsed.count() / (kRounds * kBatch);
+}
+
+}  // namespace
+
+BENCHMARK(LastRelease) {
+    Report("MakeShared<int> release", 1, ReleaseNs([] { return MakeShared<int>(42); }));
+    Report("std::make_shared<int> release", 1, ReleaseNs([] { return std::make_shared<int>(42); }));
+    Report("MakeShared<std::string> release", 1,
+           ReleaseNs([] { return MakeShared<std::string>("short"); }));
+    Report("std::make_shared<std::string> release", 1,
+           ReleaseNs([] { return std::make_shared<std::string>("short"); }));
+    Report("SharedPtr<int>(new) release", 1,
+           ReleaseNs([] { return SharedPtr<int>(new int(42)); }));
+    Report("std::shared_ptr<int>(new) release", 1,
+           ReleaseNs([] { return std::shared_ptr<int>(new int(42)); }));
+}
+
+// The three outcomes of dropping a strong reference: others remain, the last one goes with a weak
+// reference still around, and the last reference of any kind goes.
+BENCHMARK(ReleasePath) {
+    auto shared = MakeShared<int>(42);
+    auto std_shared = std::make_shared<int>(42);
+    Report("SharedPtr non-last release", 1, ReleaseNs([&] { return shared; }));
+    Report("std::shared_ptr non-last release", 1, ReleaseNs([&] { return std_shared; }));
+    Report("SharedPtr last release, weak left", 1,
+           ReleaseWithWeakNs([] { return MakeShared<int>(42); },
+                             [](const SharedPtr<int>& ptr) { return WeakPtr<int>(ptr); }));
+    Report("std::shared_ptr last release, weak left", 1,
+           ReleaseWithWeakNs([] { return std::make_shared<int>(42); },
+                             [](const std::shared_ptr<int>& ptr) { return std::weak_ptr(ptr); }));
+    Report("SharedPtr last release", 1, ReleaseNs([] { return MakeShared<int>(42); }));
+    Report("std::shared_ptr last release", 1, ReleaseNs([] { return std::make_shared<int>(42); }));
+}
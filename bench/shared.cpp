@@ -0,0 +1,78 @@
+#include "bench.h"
+
+#include "shared-from-this/shared.h"
+#include "shared-from-this/weak.h"
+
+#include <memory>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Every thread copies and drops references to one shared object, so all of them hammer the same
+// control block.
+
+constexpr size_t kIterations = 1'000'000;
+
+BENCHMARK(SharedPtrCopyContended) {
+    for (size_t threads : ThreadCounts()) {
+        auto shared = MakeShared<int>(42);
+        Report("SharedPtr copy+destroy", threads,
+               MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+                   for (size_t i = 0; i < iterations; ++i) {
+                       SharedPtr<int> copy = shared;
+                       DoNotOptimize(copy);
+                   }
+               }));
+
+        auto std_shared = std::make_shared<int>(42);
+        Report("std::shared_ptr copy+destroy", threads,
+               MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+                   for (size_t i = 0; i < iterations; ++i) {
+                       std::shared_ptr<int> copy = std_shared;
+                       DoNotOptimize(copy);
+                   }
+               }));
+    }
+}
+
+BENCHMARK(WeakPtrLockContended) {
+    for (size_t threads : ThreadCounts()) {
+        auto shared = MakeShared<int>(42);
+        WeakPtr<int> weak(shared);
+        Report("WeakPtr::Lock", threads,
+               MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+                   for (size_t i = 0; i < iterations; ++i) {
+                       SharedPtr<int> locked = weak.Lock();
+                       DoNotOptimize(locked);
+                   }
+               }));
+
+        auto std_shared = std::make_shared<int>(42);
+        std::weak_ptr<int> std_weak(std_shared);
+        Report("std::weak_ptr::lock", threads,
+               MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+                   for (size_t i = 0; i < iterations; ++i) {
+                       std::shared_ptr<int> locked = std_weak.lock();
+                       DoNotOptimize(locked);
+                   }
+               }));
+    }
+}
+
+BENCHMARK(SharedPtrCreateRelease) {
+    for (size_t threads : ThreadCounts()) {
+        Report("MakeShared+last release", threads,
+               MeasureNsPerOp(threads, kIterations, [](size_t, size_t iterations) {
+                   for (size_t i = 0; i < iterations; ++i) {
+                       auto shared = MakeShared<int>(42);
+                       DoNotOptimize(shared);
+                   }
+               }));
+
+        Report("std::make_shared+last release", threads,
+               MeasureNsPerOp(threads, kIterations, [](size_t, size_t iterations) {
+                   for (size_t i = 0; i < iterations; ++i) {
+                       auto shared = std::make_shared<int>(42);
+                       DoNotOptimize(shared);
+                   }
+               }));
+    }
+}
@@ -0,0 +1,63 @@
+#include "bench.h"
+
+#include "shared-from-this/atomic_shared.h"
+#include "shared-from-this/hazard.h"
+#include "shared-from-this/snapshot.h"
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Read-mostly data with one writer republishing it in the background, read through each of the
+// publication schemes.
+
+namespace {
+
+constexpr size_t kIterations = 1'000'000;
+
+struct Config {
+    explicit Config(int config_version) : version(config_version) {
+    }
+
+    int version;
+};
+
+// Runs `read` on `threads` threads while one more thread publishes new versions with `write`.
+template <typename Read, typename Write>
+double ReadNs(size_t threads, Read read, Write write) {
+    std::atomic<bool> done = false;
+    std::thread writer([&] {
+        for (int version = 0; !done.load(std::memory_order_relaxed); ++version) {
+            write(version);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+    double ns = MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+        for (size_t i = 0; i < iterations; ++i) {
+            read();
+        }
+    });
+    done = true;
+    writer.join();
+    return ns;
+}
+
+}  // namespace
+
+BENCHMARK(SnapshotCell) {
+    SnapshotCell<Config> snapshot_cell;
+    snapshot_cell.Publish(0);
+    HazardCell<Config> hazard_cell(MakeShared<Config>(0));
+    AtomicSharedPtr<Config> atomic(MakeShared<Config>(0));
+    for (size_t threads : ThreadCounts()) {
+        Report("SnapshotCell::Read", threads,
+               ReadNs(
+                   threads, [&] { DoNotOptimize(snapshot_cell.Read()->version); },
+                   [&](int version) { snapshot_cell.Publish(version); }));
+        Report("HazardCell::Borrow", threads,
+               ReadNs(
+                   threads, [&] { DoNotOptimize(hazard_cell.Borrow()->version); },
+                   [&](int version) { hazard_cell.Store(MakeShared<Config>(version)); }));
+        Report("AtomicSharedPtr::Load", threads,
+               ReadNs(
+                   threads, [&] { DoNotOptimize(atomic.Load()->version); },
+                   [&](int version) { atomic.Store(MakeShared<Config>(version)); }));
+    }
+}
@@ -0,0 +1,188 @@
+#include "bench.h"
+
+#include "intrusive/intrusive.h"
+#include "shared-from-this/shared.h"
+#include "shared-from-this/weak.h"
+#include "unique/unique.h"
+
+#include <memory>
+#include <utility>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// The basic operations of every pointer type next to their standard counterparts. Each thread
+// works on pointers of its own, so the numbers are the cost of the operation itself; the other
+// files cover contention. Destruction is timed together with whatever created the pointer.
+
+namespace {
+
+constexpr size_t kIterations = 1'000'000;
+
+struct Widget : EnableSharedFromThis<Widget> {
+    int value = 42;
+};
+
+struct StdWidget : std::enable_shared_from_this<StdWidget> {
+    int value = 42;
+};
+
+struct IntrusiveWidget : ThreadSafeRefCounted<IntrusiveWidget> {
+    int value = 42;
+};
+
+// Every thread makes its state with `setup()` and then runs `op(state)` in a loop.
+template <typename Setup, typename Op>
+double PerThreadNs(size_t threads, Setup setup, Op op) {
+    return MeasureNsPerOp(threads, kIterations, [&](size_t, size_t iterations) {
+        auto state = setup();
+        for (size_t i = 0; i < iterations; ++i) {
+            op(state);
+        }
+    });
+}
+
+template <typename Make>
+double CreateNs(size_t threads, Make make) {
+    return PerThreadNs(
+        threads, [] { return 0; },
+        [&](int) {
+            auto ptr = make();
+            DoNotOptimize(ptr);
+        });
+}
+
+template <typename Make>
+double CopyNs(size_t threads, Make make) {
+    return PerThreadNs(threads, make, [](const auto& ptr) {
+        auto copy = ptr;
+        DoNotOptimize(copy);
+    });
+}
+
+// One move construction and one move assignment.
+template <typename Make>
+double MoveNs(size_t threads, Make make) {
+    return PerThreadNs(threads, make, [](auto& ptr) {
+        auto moved = std::move(ptr);
+        DoNotOptimize(moved);
+        ptr = std::move(moved);
+    });
+}
+
+template <typename Make, typename Swap>
+double SwapNs(size_t threads, Make make, Swap swap) {
+    return PerThreadNs(
+        threads, [&] { return std::pair(make(), make()); },
+        [&](auto& pair) {
+            swap(pair.first, pair.second);
+            DoNotOptimize(pair.first);
+        });
+}
+
+}  // namespace
+
+BENCHMARK(SuiteCreate) {
+    for (size_t threads : ThreadCounts()) {
+        Report("UniquePtr(new)+destroy", threads,
+               CreateNs(threads, [] { return UniquePtr<int>(new int(42)); }));
+        Report("std::unique_ptr(new)+destroy", threads,
+               CreateNs(threads, [] { return std::unique_ptr<int>(new int(42)); }));
+        Report("SharedPtr(new)+destroy", threads,
+               CreateNs(threads, [] { return SharedPtr<int>(new int(42)); }));
+        Report("std::shared_ptr(new)+destroy", threads,
+               CreateNs(threads, [] { return std::shared_ptr<int>(new int(42)); }));
+        Report("MakeShared+destroy", threads,
+               CreateNs(threads, [] { return MakeShared<int>(42); }));
+        Report("std::make_shared+destroy", threads,
+               CreateNs(threads, [] { return std::make_shared<int>(42); }));
+        Report("MakeIntrusive+destroy", threads,
+               CreateNs(threads, [] { return MakeIntrusive<IntrusiveWidget>(); }));
+    }
+}
+
+BENCHMARK(SuiteCopy) {
+    for (size_t threads : ThreadCounts()) {
+        Report("SharedPtr copy+destroy uncontended", threads,
+               CopyNs(threads, [] { return MakeShared<int>(42); }));
+        Report("std::shared_ptr copy+destroy uncontended", threads,
+               CopyNs(threads, [] { return std::make_shared<int>(42); }));
+        Report("IntrusivePtr copy+destroy uncontended", threads,
+               CopyNs(threads, [] { return MakeIntrusive<IntrusiveWidget>(); }));
+    }
+}
+
+BENCHMARK(SuiteMove) {
+    for (size_t threads : ThreadCounts()) {
+        Report("UniquePtr move", threads,
+               MoveNs(threads, [] { return UniquePtr<int>(new int(42)); }));
+        Report("std::unique_ptr move", threads,
+               MoveNs(threads, [] { return std::make_unique<int>(42); }));
+        Report("SharedPtr move", threads, MoveNs(threads, [] { return MakeShared<int>(42); }));
+        Report("std::shared_ptr move", threads,
+               MoveNs(threads, [] { return std::make_shared<int>(42); }));
+        Report("IntrusivePtr move", threads,
+               MoveNs(threads, [] { return MakeIntrusive<IntrusiveWidget>(); }));
+    }
+}
+
+BENCHMARK(SuiteSwap) {
+    auto swap = [](auto& left, auto& right) { left.Swap(right); };
+    auto std_swap = [](auto& left, auto& right) { left.swap(right); };
+    for (size_t threads : ThreadCounts()) {
+        Report("UniquePtr::Swap", threads,
+               SwapNs(threads, [] { return UniquePtr<int>(new int(42)); }, swap));
+        Report("std::unique_ptr::swap", threads,
+               SwapNs(threads, [] { return std::make_unique<int>(42); }, std_swap));
+        Report("SharedPtr::Swap", threads,
+               SwapNs(threads, [] { return MakeShared<int>(42); }, swap));
+        Report("std::shared_ptr::swap", threads,
+               SwapNs(threads, [] { return std::make_shared<int>(42); }, std_swap));
+        Report("IntrusivePtr::Swap", threads,
+               SwapNs(threads, [] { return MakeIntrusive<IntrusiveWidget>(); }, swap));
+    }
+}
+
+BENCHMARK(SuiteLock) {
+    for (size_t threads : ThreadCounts()) {
+        Report("WeakPtr::Lock uncontended", threads,
+               PerThreadNs(
+                   threads,
+                   [] {
+                       auto shared = MakeShared<int>(42);
+                       return std::pair(shared, WeakPtr<int>(shared));
+                   },
+                   [](const auto& state) {
+                       auto locked = state.second.Lock();
+                       DoNotOptimize(locked);
+                   }));
+        Report("std::weak_ptr::lock uncontended", threads,
+               PerThreadNs(
+                   threads,
+                   [] {
+                       auto shared = std::make_shared<int>(42);
+                       return std::pair(shared, std::weak_ptr<int>(shared));
+                   },
+                   [](const auto& state) {
+                       auto locked = state.second.lock();
+                       DoNotOptimize(locked);
+                   }));
+    }
+}
+
+BENCHMARK(SuiteSharedFromThis) {
+    for (size_t threads : ThreadCounts()) {
+        Report("SharedFromThis", threads,
+               PerThreadNs(
+                   threads, [] { return MakeShared<Widget>(); },
+                   [](const auto& widget) {
+                       auto self = widget->SharedFromThis();
+                       DoNotOptimize(self);
+                   }));
+        Report("std::shared_from_this", threads,
+               PerThreadNs(
+                   threads, [] { return std::make_shared<StdWidget>(); },
+                   [](const auto& widget) {
+                       auto self = widget->shared_from_this();
+                       DoNotOptimize(self);
+                   }));
+    }
+}
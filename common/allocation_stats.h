@@ -0,0 +1,247 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <source_location>
+#include <string>
+#include <tuple>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+
+// Define to 1 to have the pointers record every heap allocation they make in `AllocationStats`:
+// control blocks, objects made together with them or for them (`MakeShared`, `MakeIntrusive`,
+// `ObjectPool`), and so on. Objects handed to a pointer already allocated are not counted.
+// Every translation unit of a program must agree on it.
+#ifndef SMART_PTR_ALLOCATION_STATS
+#define SMART_PTR_ALLOCATION_STATS 0
+#endif
+
+inline std::string DemangledTypeName(const char* name) {
+#if __has_include(<cxxabi.h>)
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status == 0) {
+        std::string result(demangled);
+        std::free(demangled);
+        return result;
+    }
+#endif
+    return name;
+}
+
+// Names the call site of the allocations made on this thread while it is alive, the innermost one
+// winning: `AllocationSite site;` right before the code to attribute.
+class AllocationSite {
+public:
+    explicit AllocationSite(std::source_location site = std::source_location::current())
+        : previous_(std::exchange(current, site)) {
+    }
+
+    AllocationSite(const AllocationSite&) = delete;
+    AllocationSite& operator=(const AllocationSite&) = delete;
+
+    ~AllocationSite() {
+        current = previous_;
+    }
+
+    // Default-constructed, with an empty file name, outside of any site.
+    static std::source_location Current() {
+        return current;
+    }
+
+private:
+    std::source_location previous_;
+
+    static inline thread_local std::source_location current{};
+};
+
+// Allocation counts and bytes by call site and allocated type. Every thread records into a table
+// of its own, so recording only ever contends with reports; the tables of exited threads are
+// folded into a shared one.
+class AllocationStats {
+public:
+    struct Entry {
+        // Empty for allocations made outside of any `AllocationSite`, and in `ByType()`.
+        std::string file;
+        std::string function;
+        uint32_t line = 0;
+        std::string type;
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+    };
+
+    static void Record(const std::type_info& type, size_t bytes) {
+        ThreadTable& table = GetThreadTable();
+        std::lock_guard guard(table.mutex);
+        Counts& counts = table.counts[Key{AllocationSite::Current(), type}];
+        ++counts.allocations;
+        counts.bytes += bytes;
+    }
+
+    // By call site and type, most bytes first.
+    static std::vector<Entry> BySite() {
+        return Sorted(Merge(true));
+    }
+
+    // By type over all call sites, most bytes first.
+    static std::vector<Entry> ByType() {
+        return Sorted(Merge(false));
+    }
+
+    static void Reset() {
+        State& state = GetState();
+        std::lock_guard guard(state.mutex);
+        for (ThreadTable* table : state.tables) {
+            std::lock_guard table_guard(table->mutex);
+            table->counts.clear();
+        }
+        state.exited.clear();
+    }
+
+    static void Print(std::FILE* out = stderr) {
+        std::fprintf(out, "%12s %12s  %-40s %s\n", "allocations", "bytes", "type", "site");
+        for (const Entry& entry : BySite()) {
+            std::fprintf(out, "%12llu %12llu  %-40s %s:%u %s\n",
+                         static_cast<unsigned long long>(entry.allocations),
+                         static_cast<unsigned long long>(entry.bytes), entry.type.c_str(),
+                         entry.file.empty() ? "?" : entry.file.c_str(), entry.line,
+                         entry.function.c_str());
+        }
+    }
+
+private:
+    // Site strings are compared by address, so the same site may appear under several keys
+    // (one per translation unit); `Merge` compares them by contents.
+    struct Key {
+        std::source_location site;
+        std::type_index type;
+
+        bool operator==(const Key& other) const {
+            return site.file_name() == other.site.file_name() &&
+                   site.function_name() == other.site.function_name() &&
+                   site.line() == other.site.line() && site.column() == other.site.column() &&
+                   type == other.type;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            size_t hash = std::hash<const void*>()(key.site.file_name());
+            hash = hash * 31 + key.site.line();
+            hash = hash * 31 + key.site.column();
+            return hash * 31 + key.type.hash_code();
+        }
+    };
+
+    struct Counts {
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+    };
+
+    using Table = std::unordered_map<Key, Counts, KeyHash>;
+
+    struct ThreadTable {
+        std::mutex mutex;
+        Table counts;
+    };
+
+    struct State {
+        std::mutex mutex;
+        std::vector<ThreadTable*> tables;
+        Table exited;
+    };
+
+    // Folds the table of the thread into `exited` when the thread exits.
+    struct ThreadExit {
+        ThreadTable table;
+
+        ThreadExit() {
+            State& state = GetState();
+            std::lock_guard guard(state.mutex);
+            state.tables.push_back(&table);
+        }
+
+        ~ThreadExit() {
+            State& state = GetState();
+            std::lock_guard guard(state.mutex);
+            std::erase(state.tables, &table);
+            for (const auto& [key, counts] : table.counts) {
+                Counts& total = state.exited[key];
+                total.allocations += counts.allocations;
+                total.bytes += counts.bytes;
+            }
+        }
+    };
+
+    static State& GetState() {
+        // Never destroyed: threads may still record while the program exits.
+        static State* state = new State;
+        return *state;
+    }
+
+    static ThreadTable& GetThreadTable() {
+        static thread_local ThreadExit thread_exit;
+        return thread_exit.table;
+    }
+
+    static std::vector<Entry> Merge(bool by_site) {
+        std::vector<Entry> entries;
+        auto add = [&](const Key& key, const Counts& counts) {
+            Entry entry;
+            if (by_site) {
+                entry.file = key.site.file_name();
+                entry.function = key.site.function_name();
+                entry.line = key.site.line();
+            }
+            entry.type = DemangledTypeName(key.type.name());
+            auto same = [&](const Entry& other) {
+                return std::tie(other.file, other.function, other.line, other.type) ==
+                       std::tie(entry.file, entry.function, entry.line, entry.type);
+            };
+            auto it = std::find_if(entries.begin(), entries.end(), same);
+            if (it == entries.end()) {
+                it = entries.insert(entries.end(), std::move(entry));
+            }
+            it->allocations += counts.allocations;
+            it->bytes += counts.bytes;
+        };
+
+        State& state = GetState();
+        std::lock_guard guard(state.mutex);
+        for (const auto& [key, counts] : state.exited) {
+            add(key, counts);
+        }
+        for (ThreadTable* table : state.tables) {
+            std::lock_guard table_guard(table->mutex);
+            for (const auto& [key, counts] : table->counts) {
+                add(key, counts);
+            }
+        }
+        return entries;
+    }
+
+    static std::vector<Entry> Sorted(std::vector<Entry> entries) {
+        std::stable_sort(entries.begin(), entries.end(),
+                         [](const Entry& a, const Entry& b) { return a.bytes > b.bytes; });
+        return entries;
+    }
+};
+
+// Called by the pointers on every heap allocation they make, with `T` the type they allocate for.
+template <typename T>
+inline void RecordPointerAllocation([[maybe_unused]] size_t bytes) {
+#if SMART_PTR_ALLOCATION_STATS
+    AllocationStats::Record(typeid(T), bytes);
+#endif
+}
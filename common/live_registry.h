@@ -0,0 +1,188 @@
+#pragma once
+
+#include "allocation_stats.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <source_location>
+#include <string>
+#include <tuple>
+#include <typeinfo>
+#include <vector>
+
+// Define to 1 to have every control block and `RefCounted` object enter `LiveRegistry` while it
+// is alive, so that long runs can tell what is still owned and by how many references. Copies
+// and releases never touch the registry. Every translation unit of a program must agree on it.
+#ifndef SMART_PTR_LIVE_REGISTRY
+#define SMART_PTR_LIVE_REGISTRY 0
+#endif
+
+struct LiveCounts {
+    size_t strong = 0;
+    size_t weak = 0;
+};
+
+// The registry's node for one object, embedded in it.
+struct LiveObject {
+    const void* object = nullptr;
+    // Null while the object is not registered.
+    const std::type_info* type = nullptr;
+    LiveCounts (*counts)(const void* object) = nullptr;
+    // The `AllocationSite` the object was registered in.
+    std::source_location site;
+    LiveObject* prev = nullptr;
+    LiveObject* next = nullptr;
+};
+
+// The live objects, in shards picked by address so that threads creating and destroying objects
+// rarely share a lock. At exit whatever is still registered is reported as leaked; objects owned
+// by statics that outlive the registry's own show up there too.
+class LiveRegistry {
+public:
+    static constexpr size_t kNumShards = 64;
+
+    struct Entry {
+        std::string type;
+        // Empty for objects created outside of any `AllocationSite`.
+        std::string file;
+        std::string function;
+        uint32_t line = 0;
+        const void* address = nullptr;
+        LiveCounts counts;
+    };
+
+    static void Add(LiveObject* node, const void* object, const std::type_info& type,
+                    LiveCounts (*counts)(const void*)) {
+        static ExitReport exit_report;
+        node->object = object;
+        node->type = &type;
+        node->counts = counts;
+        node->site = AllocationSite::Current();
+        Shard& shard = ShardOf(node);
+        std::lock_guard guard(shard.mutex);
+        node->prev = nullptr;
+        node->next = shard.head;
+        if (shard.head != nullptr) {
+            shard.head->prev = node;
+        }
+        shard.head = node;
+        ++shard.size;
+    }
+
+    // Does nothing if `node` is not registered.
+    static void Remove(LiveObject* node) {
+        if (node->type == nullptr) {
+            return;
+        }
+        Shard& shard = ShardOf(node);
+        std::lock_guard guard(shard.mutex);
+        (node->prev != nullptr ? node->prev->next : shard.head) = node->next;
+        if (node->next != nullptr) {
+            node->next->prev = node->prev;
+        }
+        --shard.size;
+        node->type = nullptr;
+    }
+
+    static size_t Size() {
+        size_t size = 0;
+        for (Shard& shard : Shards()) {
+            std::lock_guard guard(shard.mutex);
+            size += shard.size;
+        }
+        return size;
+    }
+
+    // The objects alive at the time each shard is visited, with their current counts.
+    static std::vector<Entry> Snapshot() {
+        std::vector<Entry> entries;
+        for (Shard& shard : Shards()) {
+            // Objects unregister under the same lock, so none is destroyed while it is read.
+            std::lock_guard guard(shard.mutex);
+            for (LiveObject* node = shard.head; node != nullptr; node = node->next) {
+                entries.push_back({DemangledTypeName(node->type->name()), node->site.file_name(),
+                                   node->site.function_name(), node->site.line(), node->object,
+                                   node->counts(node->object)});
+            }
+        }
+        return entries;
+    }
+
+    // Live objects by type and site, most numerous first.
+    static void Report(std::FILE* out = stderr) {
+        struct Group {
+            const Entry* first;
+            size_t objects;
+            size_t strong;
+            size_t weak;
+        };
+        std::vector<Entry> entries = Snapshot();
+        auto key = [](const Entry& entry) {
+            return std::tie(entry.type, entry.file, entry.line, entry.function);
+        };
+        std::sort(entries.begin(), entries.end(),
+                  [&](const Entry& a, const Entry& b) { return key(a) < key(b); });
+        std::vector<Group> groups;
+        for (const Entry& entry : entries) {
+            if (groups.empty() || key(*groups.back().first) != key(entry)) {
+                groups.push_back({&entry, 0, 0, 0});
+            }
+            ++groups.back().objects;
+            groups.back().strong += entry.counts.strong;
+            groups.back().weak += entry.counts.weak;
+        }
+        std::stable_sort(groups.begin(), groups.end(),
+                         [](const Group& a, const Group& b) { return a.objects > b.objects; });
+
+        std::fprintf(out, "%zu live objects\n", entries.size());
+        std::fprintf(out, "%10s %10s %10s  %-40s %s\n", "objects", "strong", "weak", "type",
+                     "site");
+        for (const Group& group : groups) {
+            const Entry& entry = *group.first;
+            std::fprintf(out, "%10zu %10zu %10zu  %-40s %s:%u %s\n", group.objects, group.strong,
+                         group.weak, entry.type.c_str(),
+                         entry.file.empty() ? "?" : entry.file.c_str(), entry.line,
+                         entry.function.c_str());
+        }
+    }
+
+    // On by default.
+    static void SetReportAtExit(bool report) {
+        report_at_exit.store(report, std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        LiveObject* head = nullptr;
+        size_t size = 0;
+    };
+
+    struct ExitReport {
+        ~ExitReport() {
+            if (report_at_exit.load(std::memory_order_relaxed) && Size() != 0) {
+                std::fprintf(stderr, "LiveRegistry: objects left at exit\n");
+                Report(stderr);
+            }
+        }
+    };
+
+    static inline std::atomic<bool> report_at_exit = true;
+
+    static std::array<Shard, kNumShards>& Shards() {
+        // Never destroyed: objects may unregister after the exit report.
+        static auto shards = new std::array<Shard, kNumShards>;
+        return *shards;
+    }
+
+    static Shard& ShardOf(const LiveObject* node) {
+        auto address = reinterpret_cast<uintptr_t>(node);
+        static_assert(kNumShards == 64);
+        return Shards()[(address >> 6) * 0x9E3779B97F4A7C15 >> 58];
+    }
+};
@@ -0,0 +1,149 @@
+#include "allocation_stats.h"
+
+#include "../intrusive/intrusive.h"
+#include "../intrusive/object_pool.h"
+#include "../shared-from-this/shared.h"
+#include "../unique/unique.h"
+
+#include <catch.hpp>
+
+#include <string>
+#include <thread>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Gadget {
+    int value = 42;
+};
+
+struct BigGadget {
+    char payload[8192] = {};
+};
+
+struct IntrusiveGadget : ThreadSafeRefCounted<IntrusiveGadget> {
+    int value = 42;
+};
+
+struct PooledGadget : ObjectInPool<PooledGadget> {
+    int value = 42;
+};
+
+AllocationStats::Entry Find(const std::vector<AllocationStats::Entry>& entries,
+                            const std::string& name, uint32_t line = 0) {
+    auto type = name == "int[]" ? "int []" : "(anonymous namespace)::" + name;
+    for (const auto& entry : entries) {
+        if (entry.type == type && entry.line == line) {
+            return entry;
+        }
+    }
+    return {};
+}
+
+}  // namespace
+
+TEST_CASE("Allocations by type") {
+    AllocationStats::Reset();
+    {
+        auto shared = MakeShared<Gadget>();
+        SharedPtr<Gadget> adopted(new Gadget);
+        SharedPtr<Gadget> with_deleter(new Gadget, std::default_delete<Gadget>());
+        auto big = MakeShared<BigGadget>();
+        auto intrusive = MakeIntrusive<IntrusiveGadget>();
+        auto array = MakeShared<int[]>(10);
+    }
+
+    auto by_type = AllocationStats::ByType();
+    // The objects handed to `SharedPtr` already allocated are not counted, their blocks are.
+    auto gadget = Find(by_type, "Gadget");
+    REQUIRE(gadget.allocations == 3);
+    REQUIRE(gadget.bytes == sizeof(ControlBlockObj<Gadget>) + sizeof(ControlBlockPtr<Gadget>) +
+                                sizeof(ControlBlockDeleter<Gadget, std::default_delete<Gadget>>));
+
+    auto big = Find(by_type, "BigGadget");
+    REQUIRE(big.allocations == 2);
+    REQUIRE(big.bytes == sizeof(BigGadget) + sizeof(ControlBlockPtr<BigGadget>));
+
+    auto intrusive = Find(by_type, "IntrusiveGadget");
+    REQUIRE(intrusive.allocations == 1);
+    REQUIRE(intrusive.bytes == sizeof(IntrusiveGadget));
+
+    auto array = Find(by_type, "int[]");
+    REQUIRE(array.allocations == 1);
+    REQUIRE(array.bytes >= 10 * sizeof(int));
+}
+
+TEST_CASE("Unique allocations by type") {
+    AllocationStats::Reset();
+    {
+        auto unique = MakeUnique<Gadget>();
+        auto overwritten = MakeUniqueForOverwrite<Gadget>();
+        auto array = MakeUniqueForOverwrite<int[]>(5);
+    }
+
+    auto by_type = AllocationStats::ByType();
+    auto gadget = Find(by_type, "Gadget");
+    REQUIRE(gadget.allocations == 2);
+    REQUIRE(gadget.bytes == 2 * sizeof(Gadget));
+
+    auto array = Find(by_type, "int[]");
+    REQUIRE(array.allocations == 1);
+    REQUIRE(array.bytes == 5 * sizeof(int));
+}
+
+TEST_CASE("Allocations by site") {
+    AllocationStats::Reset();
+    uint32_t outer_line;
+    uint32_t inner_line;
+    {
+        AllocationSite outer;
+        outer_line = __LINE__ - 1;
+        auto first = MakeShared<Gadget>();
+        {
+            AllocationSite inner;
+            inner_line = __LINE__ - 1;
+            auto second = MakeShared<Gadget>();
+            auto third = MakeShared<Gadget>();
+        }
+        auto fourth = MakeIntrusive<IntrusiveGadget>();
+    }
+    auto unattributed = MakeShared<Gadget>();
+
+    auto by_site = AllocationStats::BySite();
+    REQUIRE(by_site.size() == 4);
+    auto outer = Find(by_site, "Gadget", outer_line);
+    REQUIRE(outer.file.find("test_allocation_stats.cpp") != std::string::npos);
+    REQUIRE(outer.allocations == 1);
+    REQUIRE(Find(by_site, "IntrusiveGadget", outer_line).allocations == 1);
+    REQUIRE(Find(by_site, "Gadget", inner_line).allocations == 2);
+    auto none = Find(by_site, "Gadget", 0);
+    REQUIRE(none.allocations == 1);
+    REQUIRE(none.file.empty());
+    // Sorted by bytes.
+    REQUIRE(by_site.front().line == inner_line);
+}
+
+TEST_CASE("Allocations of exited threads and pools") {
+    AllocationStats::Reset();
+    std::thread([] {
+        AllocationSite site;
+        for (int i = 0; i < 10; ++i) {
+            auto gadget = MakeShared<Gadget>();
+        }
+    }).join();
+    {
+        ObjectPool<PooledGadget> pool;
+        for (int i = 0; i < 10; ++i) {
+            auto gadget = pool.Allocate();
+        }
+    }
+
+    auto by_type = AllocationStats::ByType();
+    REQUIRE(Find(by_type, "Gadget").allocations == 10);
+    // Recycled after the first one.
+    REQUIRE(Find(by_type, "PooledGadget").allocations == 1);
+
+    AllocationStats::Reset();
+    REQUIRE(AllocationStats::BySite().empty());
+}
@@ -0,0 +1,188 @@
+#include "live_registry.h"
+
+#include "../intrusive/intrusive.h"
+#include "../shared-from-this/biased.h"
+#include "../shared-from-this/shared.h"
+#include "../shared-from-this/weak.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Widget {
+    int value = 42;
+};
+
+struct IntrusiveWidget : ThreadSafeRefCounted<IntrusiveWidget> {
+    int value = 42;
+};
+
+struct WeakWidget : WeakRefCounted<WeakWidget> {
+    int value = 42;
+};
+
+// The live objects whose type name contains `name`.
+std::vector<LiveRegistry::Entry> Live(const std::string& name) {
+    std::vector<LiveRegistry::Entry> found;
+    for (auto& entry : LiveRegistry::Snapshot()) {
+        if (entry.type.find(name) != std::string::npos) {
+            found.push_back(std::move(entry));
+        }
+    }
+    return found;
+}
+
+std::vector<size_t> StrongCounts(const std::vector<LiveRegistry::Entry>& entries) {
+    std::vector<size_t> counts;
+    for (const auto& entry : entries) {
+        counts.push_back(entry.counts.strong);
+    }
+    std::sort(counts.begin(), counts.end());
+    return counts;
+}
+
+}  // namespace
+
+TEST_CASE("Live control blocks") {
+    REQUIRE(Live("Widget").empty());
+    {
+        auto shared = MakeShared<Widget>();
+        auto copy = shared;
+        WeakPtr<Widget> weak(shared);
+        auto live = Live("Widget");
+        REQUIRE(live.size() == 1);
+        REQUIRE(live[0].type == "ControlBlockObj<(anonymous namespace)::Widget>");
+        REQUIRE(live[0].counts.strong == 2);
+        REQUIRE(live[0].counts.weak == 1);
+
+        shared.Reset();
+        copy.Reset();
+        // Only the block is left, for the weak pointer.
+        live = Live("Widget");
+        REQUIRE(live.size() == 1);
+        REQUIRE(live[0].counts.strong == 0);
+        REQUIRE(live[0].counts.weak == 1);
+    }
+    REQUIRE(Live("Widget").empty());
+}
+
+TEST_CASE("Live control blocks of every counting policy") {
+    {
+        SharedPtr<Widget> adopted(new Widget);
+        auto local = MakeLocalShared<Widget>();
+        auto local_copy = local;
+        auto biased = MakeShared<Widget, BiasedCounting>();
+        auto biased_copy = biased;
+        auto biased_other = biased;
+
+        auto pointers = Live("ControlBlockPtr");
+        REQUIRE(pointers.size() == 1);
+        REQUIRE(pointers[0].counts.strong == 1);
+        REQUIRE(StrongCounts(Live("ControlBlockObj")) == std::vector<size_t>{2, 3});
+    }
+    REQUIRE(Live("Widget").empty());
+}
+
+TEST_CASE("Live intrusive objects") {
+    {
+        auto widget = MakeIntrusive<IntrusiveWidget>();
+        auto copy = widget;
+        auto weak_widget = MakeIntrusive<WeakWidget>();
+        IntrusiveWeakPtr<WeakWidget> weak(weak_widget);
+        IntrusiveWeakPtr<WeakWidget> other_weak(weak_widget);
+
+        auto live = Live("IntrusiveWidget");
+        REQUIRE(live.size() == 1);
+        REQUIRE(live[0].type == "(anonymous namespace)::IntrusiveWidget");
+        REQUIRE(live[0].counts.strong == 2);
+        REQUIRE(live[0].counts.weak == 0);
+
+        live = Live("WeakWidget");
+        REQUIRE(live.size() == 1);
+        REQUIRE(live[0].counts.strong == 1);
+        REQUIRE(live[0].counts.weak == 2);
+
+        // Destroyed objects leave the registry even while weak pointers keep their memory.
+        weak_widget.Reset();
+        REQUIRE(Live("WeakWidget").empty());
+    }
+    REQUIRE(Live("Widget").empty());
+}
+
+TEST_CASE("Live objects report") {
+    uint32_t line;
+    std::vector<SharedPtr<Widget>> widgets;
+    {
+        AllocationSite site;
+        line = __LINE__ - 1;
+        for (int i = 0; i < 3; ++i) {
+            widgets.push_back(MakeShared<Widget>());
+        }
+    }
+    auto other = MakeShared<Widget>();
+    auto copy = other;
+
+    auto live = Live("Widget");
+    REQUIRE(live.size() == 4);
+    REQUIRE(std::count_if(live.begin(), live.end(), [&](const auto& entry) {
+                return entry.line == line &&
+                       entry.file.find("test_live_registry.cpp") != std::string::npos;
+            }) == 3);
+
+    std::FILE* out = std::tmpfile();
+    LiveRegistry::Report(out);
+    std::rewind(out);
+    std::string report;
+    for (int c = std::fgetc(out); c != EOF; c = std::fgetc(out)) {
+        report += static_cast<char>(c);
+    }
+    std::fclose(out);
+    REQUIRE(report.find("4 live objects") != std::string::npos);
+    // Grouped by site, the larger group first.
+    auto first = report.find("ControlBlockObj<(anonymous namespace)::Widget>");
+    REQUIRE(first != std::string::npos);
+    std::string site = ":";
+    site.append(std::to_string(line));
+    REQUIRE(report.find(site, first) != std::string::npos);
+    REQUIRE(report.find("         3          3          0") != std::string::npos);
+    REQUIRE(report.find("         1          2          0") != std::string::npos);
+}
+
+TEST_CASE("Live objects concurrent") {
+    constexpr int kNumThreads = 4;
+    constexpr int kNumObjects = 20'000;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([] {
+            std::vector<SharedPtr<Widget>> widgets;
+            // Reallocation would copy the pointers.
+            widgets.reserve(kNumObjects);
+            for (int j = 0; j < kNumObjects; ++j) {
+                widgets.push_back(MakeShared<Widget>());
+                if (j % 3 == 0) {
+                    widgets.erase(widgets.begin() + j / 2);
+                }
+            }
+        });
+    }
+    size_t max_strong = 0;
+    for (int i = 0; i < 10; ++i) {
+        for (const auto& entry : Live("Widget")) {
+            max_strong = std::max(max_strong, entry.counts.strong);
+        }
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(max_strong <= 1);
+    REQUIRE(Live("Widget").empty());
+}
@@ -1,8 +1,18 @@
 #pragma once
 
-#include <cstddef>  // for std::nullptr_t
-#include <utility>  // for std::exchange / std::swap
+#include "../common/allocation_stats.h"
+#include "../common/live_registry.h"
 
+#include <atomic>       // for std::atomic
+#include <cstddef>      // for std::nullptr_t
+#include <new>          // for std::align_val_t / std::launder
+#include <type_traits>  // for std::conditional_t / std::is_polymorphic_v
+#include <utility>      // for std::exchange / std::swap
+
+// Counters return the number of references left from `DecRef`, so that only the release that
+// drops the count to zero destroys the object, even when several run at once.
+
+// Single-threaded.
 class SimpleCounter {
 public:
     SimpleCounter() = default;
@@ -10,8 +20,11 @@ public:
     void IncRef() {
         ++count_;
     };
-    void DecRef() {
-        --count_;
+    size_t DecRef() {
+        if (count_ > 0) {
+            --count_;
+        }
+        return count_;
     };
     size_t RefCount() const {
         return count_;
@@ -21,6 +34,80 @@ private:
     size_t count_ = 0;
 };
 
+// Thread-safe, with the same orderings as `std::shared_ptr`: a new reference is always made from
+// an existing one, so increments are relaxed; decrements are acq_rel so that the thread that
+// destroys the object sees every write made through the other references.
+class AtomicCounter {
+public:
+    AtomicCounter() = default;
+
+    void IncRef() {
+        count_.fetch_add(1, std::memory_order_relaxed);
+    };
+    size_t DecRef() {
+        return count_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    };
+    size_t RefCount() const {
+        return count_.load(std::memory_order_relaxed);
+    };
+
+private:
+    std::atomic<size_t> count_ = 0;
+};
+
+// Strong and weak counts for `IntrusiveWeakPtr`, thread-safe like `AtomicCounter`. The strong
+// references collectively hold one weak reference, so the memory is freed exactly once, by
+// whoever drops the weak count to zero. Both counts are trivially destructible and stay usable
+// after the object is destroyed, until its memory is freed.
+class WeakCounter {
+public:
+    WeakCounter() = default;
+
+    void IncRef() {
+        strong_.fetch_add(1, std::memory_order_relaxed);
+    };
+    size_t DecRef() {
+        return strong_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    };
+    size_t RefCount() const {
+        return strong_.load(std::memory_order_relaxed);
+    };
+
+    // Never revives an object whose strong count has reached zero.
+    bool TryIncRef() {
+        size_t count = strong_.load(std::memory_order_relaxed);
+        while (count != 0) {
+            if (strong_.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel,
+                                              std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    void IncWeakRef() {
+        weak_.fetch_add(1, std::memory_order_relaxed);
+    };
+    size_t DecWeakRef() {
+        // Nobody can make a new weak reference without holding one, so if ours is the only one
+        // left the read-modify-write can be skipped.
+        if (weak_.load(std::memory_order_acquire) == 1) {
+            return 0;
+        }
+        return weak_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    };
+
+    // Leaves out the weak reference the strong ones hold together.
+    size_t WeakRefCount() const {
+        size_t weak = weak_.load(std::memory_order_relaxed);
+        return weak - (strong_.load(std::memory_order_relaxed) != 0 && weak != 0);
+    };
+
+private:
+    std::atomic<size_t> strong_ = 0;
+    std::atomic<size_t> weak_ = 1;
+};
+
 struct DefaultDelete {
 
     DefaultDelete() = default;
@@ -29,45 +116,171 @@ struct DefaultDelete {
     static void Destroy(T* object) {
         delete object;
     }
+
+    // With `WeakCounter` the object is destroyed when the last strong reference goes and its
+    // memory freed when the last weak one does. The memory must come from plain `new` of the
+    // most-derived type, aligned no more strictly than `T`; `memory` is where that object starts.
+    template <typename T>
+    static void DestroyObject(T* object) {
+        object->~T();
+    }
+
+    template <typename T>
+    static void Deallocate(void* memory) {
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(memory, std::align_val_t{alignof(T)});
+        } else {
+            ::operator delete(memory);
+        }
+    }
 };
 
 template <typename Derived, typename Counter, typename Deleter>
 class RefCounted {
+    static constexpr bool kWeak = requires(Counter counter) { counter.DecWeakRef(); };
+
 public:
-    RefCounted() : counter_(Counter()){};
-    RefCounted(const RefCounted& other) : counter_(Counter()){};
+    // What weak pointers hold on to instead of the object: the counts and, once the object is
+    // destroyed, the start of its memory.
+    struct WeakState {
+        Counter counter;
+        void* memory = nullptr;
+    };
+
+    RefCounted() {
+        new (state_) State();
+        Track();
+    };
+    RefCounted(const RefCounted& other) {
+        new (state_) State();
+        Track();
+    };
     RefCounted& operator=(const RefCounted& other) {
         return *this;
     };
+#if SMART_PTR_LIVE_REGISTRY
+    ~RefCounted() {
+        LiveRegistry::Remove(&live_);
+    };
+#else
     ~RefCounted() = default;
+#endif
     // Increase reference counter.
     void IncRef() {
-        counter_.IncRef();
+        Counts(this).IncRef();
     };
 
     // Decrease reference counter.
     // Destroy object using Deleter when the last instance dies.
     void DecRef() {
-        if (counter_.RefCount() > 0) {
-            counter_.DecRef();
+        if (Counts(this).DecRef() != 0) {
+            return;
         }
-        if (counter_.RefCount() == 0) {
-            Deleter{}.Destroy(static_cast<Derived*>(this));
+        auto object = static_cast<Derived*>(this);
+        if constexpr (kWeak) {
+            // Neither the object nor `this` is used once the destruction starts.
+            WeakState* state = &StateOf(this);
+            if constexpr (std::is_polymorphic_v<Derived>) {
+                state->memory = dynamic_cast<void*>(object);
+            } else {
+                state->memory = object;
+            }
+            Deleter{}.DestroyObject(object);
+            DecWeakRef(state);
+        } else {
+            Deleter{}.Destroy(object);
         }
     };
 
     // Get current counter value (the number of strong references).
     size_t RefCount() const {
-        return counter_.RefCount();
+        return Counts(this).RefCount();
+    };
+
+    // Weak references, for counters that support them. The state is taken from a live object;
+    // weak pointers use only that afterwards, never the object, which may be destroyed.
+    static WeakState* WeakStateOf(Derived* object)
+        requires kWeak
+    {
+        return &StateOf(object);
+    };
+    static void IncWeakRef(WeakState* state) {
+        state->counter.IncWeakRef();
+    };
+    static void DecWeakRef(WeakState* state) {
+        if (state->counter.DecWeakRef() == 0) {
+            Deleter{}.template Deallocate<Derived>(state->memory);
+        }
+    };
+    static size_t RefCountOf(const WeakState* state) {
+        return state->counter.RefCount();
+    };
+    // Takes a strong reference unless the object is already destroyed.
+    static bool TryIncRef(WeakState* state) {
+        return state->counter.TryIncRef();
     };
 
 private:
-    Counter counter_;
+    using State = std::conditional_t<kWeak, WeakState, Counter>;
+
+    // The state is created in raw storage that no destructor touches, so it outlives the object
+    // until the memory is freed.
+    static State& StateOf(const RefCounted* self) {
+        return *std::launder(reinterpret_cast<State*>(const_cast<unsigned char*>(self->state_)));
+    }
+
+    static Counter& Counts(const RefCounted* self) {
+        if constexpr (kWeak) {
+            return StateOf(self).counter;
+        } else {
+            return StateOf(self);
+        }
+    }
+
+    static_assert(std::is_trivially_destructible_v<Counter>);
+
+    alignas(State) unsigned char state_[sizeof(State)];
+
+#if SMART_PTR_LIVE_REGISTRY
+    LiveObject live_;
+
+    // `SimpleCounter` counts are only exact when read on the thread that owns the object.
+    static LiveCounts LiveCountsOf(const void* object) {
+        auto self = static_cast<const RefCounted*>(object);
+        if constexpr (kWeak) {
+            return {Counts(self).RefCount(), Counts(self).WeakRefCount()};
+        } else {
+            return {Counts(self).RefCount(), 0};
+        }
+    }
+#endif
+
+    void Track() {
+#if SMART_PTR_LIVE_REGISTRY
+        LiveRegistry::Add(&live_, this, typeid(Derived), &LiveCountsOf);
+#endif
+    }
 };
 
 template <typename Derived, typename D = DefaultDelete>
 using SimpleRefCounted = RefCounted<Derived, SimpleCounter, D>;
 
+// For objects shared between threads.
+template <typename Derived, typename D = DefaultDelete>
+using ThreadSafeRefCounted = RefCounted<Derived, AtomicCounter, D>;
+
+// For objects observed through `IntrusiveWeakPtr`.
+template <typename Derived, typename D = DefaultDelete>
+using WeakRefCounted = RefCounted<Derived, WeakCounter, D>;
+
+// Tag for taking over a reference that was already counted, e.g. one returned by a factory or
+// released with `Detach()` on the other side of a queue.
+struct AdoptRef {
+    explicit AdoptRef() = default;
+};
+
+inline constexpr AdoptRef kAdoptRef{};
+
 template <typename T>
 class IntrusivePtr {
     template <typename Y>
@@ -90,6 +303,9 @@ public:
         }
     };
 
+    // Takes over the reference `ptr` carries, without `IncRef()`.
+    IntrusivePtr(T* ptr, AdoptRef) : ptr_(ptr){};
+
     template <typename Y>
     IntrusivePtr(const IntrusivePtr<Y>& other) : ptr_(other.ptr_) {
         if (ptr_ != nullptr) {
@@ -164,6 +380,11 @@ public:
     void Swap(IntrusivePtr& other) {
         std::swap(ptr_, other.ptr_);
     };
+    // Gives up the pointer together with its reference, without `DecRef()`; adopt it back with
+    // `kAdoptRef`.
+    [[nodiscard]] T* Detach() {
+        return std::exchange(ptr_, nullptr);
+    };
 
     // Observers
     T* Get() const {
@@ -192,5 +413,94 @@ private:
 template <typename T, typename... Args>
 IntrusivePtr<T> MakeIntrusive(Args&&... args) {
     T* ptr = new T(std::forward<Args>(args)...);
+    RecordPointerAllocation<T>(sizeof(T));
     return IntrusivePtr(ptr);
 };
+
+// Observes an object whose counter is `WeakCounter` without keeping it alive. The object's memory
+// stays until the last weak pointer is gone, so back-pointers do not form cycles of ownership.
+template <typename T>
+class IntrusiveWeakPtr {
+    template <typename Y>
+    friend class IntrusiveWeakPtr;
+
+public:
+    // Constructors
+    IntrusiveWeakPtr() = default;
+
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusivePtr<Y>& other) : ptr_(other.Get()) {
+        if (ptr_ != nullptr) {
+            state_ = T::WeakStateOf(ptr_);
+            T::IncWeakRef(state_);
+        }
+    };
+
+    IntrusiveWeakPtr(const IntrusiveWeakPtr& other) : ptr_(other.ptr_), state_(other.state_) {
+        if (state_ != nullptr) {
+            T::IncWeakRef(state_);
+        }
+    };
+    IntrusiveWeakPtr(IntrusiveWeakPtr&& other)
+        : ptr_(std::exchange(other.ptr_, nullptr)), state_(std::exchange(other.state_, nullptr)){};
+
+    template <typename Y>
+    IntrusiveWeakPtr(const IntrusiveWeakPtr<Y>& other) : ptr_(other.ptr_), state_(other.state_) {
+        if (state_ != nullptr) {
+            T::IncWeakRef(state_);
+        }
+    };
+
+    // `operator=`-s
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr& other) {
+        IntrusiveWeakPtr(other).Swap(*this);
+        return *this;
+    };
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr&& other) {
+        IntrusiveWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    };
+
+    // Destructor
+    ~IntrusiveWeakPtr() {
+        if (state_ != nullptr) {
+            T::DecWeakRef(state_);
+        }
+    };
+
+    // Modifiers
+    void Reset() {
+        ptr_ = nullptr;
+        if (state_ != nullptr) {
+            T::DecWeakRef(std::exchange(state_, nullptr));
+        }
+    };
+    void Swap(IntrusiveWeakPtr& other) {
+        std::swap(ptr_, other.ptr_);
+        std::swap(state_, other.state_);
+    };
+
+    // Observers
+    size_t UseCount() const {
+        if (state_ == nullptr) {
+            return 0;
+        }
+        return T::RefCountOf(state_);
+    };
+    bool Expired() const {
+        return UseCount() == 0;
+    };
+    IntrusivePtr<T> Lock() const {
+        if (state_ == nullptr || !T::TryIncRef(state_)) {
+            return IntrusivePtr<T>();
+        }
+        return IntrusivePtr<T>(ptr_, kAdoptRef);
+    };
+
+private:
+    using WeakState = typename T::WeakState;
+
+    // Only converted and used once `state_` shows the object alive.
+    T* ptr_ = nullptr;
+    WeakState* state_ = nullptr;
+};
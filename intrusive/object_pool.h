@@ -0,0 +1,359 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A pool of recycled objects handed out through `IntrusivePtr`: when the last pointer goes the
+// object returns to the pool as it is, and `Allocate` gives it out again without constructing it
+// anew. In steady state neither allocates nor frees memory; the first use of a pool on a thread
+// sets up the thread's cache.
+//
+// Every thread keeps a cache of up to `kThreadCacheSize` free objects, so most allocations and
+// releases touch no shared state. A full cache moves to a global stack of batches in one CAS,
+// whichever thread the objects were released on; an empty one takes a batch back. Pushing
+// batches is lock-free, popping them takes a mutex, which rules out ABA without tagging.
+//
+// All objects must be released before the pool is destroyed. Threads may exit at any time: their
+// caches go back to the pools that are still alive.
+
+template <typename T>
+class ObjectPool;
+
+// Base of pooled objects: a thread-safe reference count and the links of the free lists.
+template <typename Derived>
+class ObjectInPool {
+public:
+    ObjectInPool() = default;
+    ObjectInPool(const ObjectInPool&) : ObjectInPool() {
+    }
+    ObjectInPool& operator=(const ObjectInPool&) {
+        return *this;
+    }
+
+    void IncRef() {
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void DecRef() {
+        if (count_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            home_->Release(static_cast<Derived*>(this));
+        }
+    }
+
+    size_t RefCount() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<size_t> count_ = 0;
+    ObjectPool<Derived>* home_ = nullptr;
+    // The next free object of the same batch.
+    ObjectInPool* next_free_ = nullptr;
+    // Only on the first object of a batch in the global stack.
+    ObjectInPool* next_batch_ = nullptr;
+    size_t batch_size_ = 0;
+
+    friend class ObjectPool<Derived>;
+};
+
+// The pools that are still alive, for threads that hand their caches back on exit.
+class ObjectPoolRegistry {
+public:
+    static uint64_t Add() {
+        State& state = GetState();
+        std::lock_guard guard(state.mutex);
+        state.live.push_back(++state.last_id);
+        return state.last_id;
+    }
+
+    static void Remove(uint64_t id) {
+        State& state = GetState();
+        std::lock_guard guard(state.mutex);
+        state.live.erase(std::find(state.live.begin(), state.live.end(), id));
+    }
+
+    // Pools cannot be destroyed while the lock is held.
+    static std::unique_lock<std::mutex> Lock() {
+        return std::unique_lock(GetState().mutex);
+    }
+
+    // Requires `Lock()`.
+    static bool IsLive(uint64_t id) {
+        const auto& live = GetState().live;
+        return std::find(live.begin(), live.end(), id) != live.end();
+    }
+
+private:
+    struct State {
+        std::mutex mutex;
+        uint64_t last_id = 0;
+        std::vector<uint64_t> live;
+    };
+
+    static State& GetState() {
+        static State state;
+        return state;
+    }
+};
+
+template <typename T>
+class ObjectPool {
+    static_assert(std::is_base_of_v<ObjectInPool<T>, T>, "Unsupported type");
+
+public:
+    static constexpr size_t kThreadCacheSize = 32;
+
+    // Keeps at most `max_idle` free objects in the global stack, on top of the thread caches;
+    // objects released beyond that are deleted.
+    explicit ObjectPool(size_t max_idle = SIZE_MAX) : max_idle_(max_idle) {
+    }
+
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    ~ObjectPool() {
+        ObjectPoolRegistry::Remove(id_);
+        std::lock_guard guard(caches_mutex_);
+        for (ThreadCache* cache = caches_; cache != nullptr;) {
+            DeleteChain(cache->head);
+            delete std::exchange(cache, cache->next);
+        }
+        for (Node* batch = batches_.load(std::memory_order_acquire); batch != nullptr;) {
+            DeleteChain(std::exchange(batch, batch->next_batch_));
+        }
+    }
+
+    // A free object as it was released, or `T(args...)` if there is none.
+    template <typename... Args>
+    IntrusivePtr<T> Allocate(Args&&... args) {
+        ThreadCache* cache = GetThreadCache();
+        if (cache->head == nullptr) {
+            Refill(cache);
+        }
+        T* object;
+        if (cache->head != nullptr) {
+            object = static_cast<T*>(cache->head);
+            cache->head = object->next_free_;
+            cache->size.store(cache->size.load(std::memory_order_relaxed) - 1,
+                              std::memory_order_relaxed);
+        } else {
+            object = New(std::forward<Args>(args)...);
+        }
+        object->count_.store(1, std::memory_order_relaxed);
+        return IntrusivePtr<T>(object, kAdoptRef);
+    }
+
+    // Constructs `count` objects as `T(args...)` and makes them available to every thread.
+    template <typename... Args>
+    void Prewarm(size_t count, const Args&... args) {
+        while (count > 0) {
+            size_t size = std::min(count, kThreadCacheSize);
+            Node* head = nullptr;
+            for (size_t i = 0; i < size; ++i) {
+                T* object = New(args...);
+                object->next_free_ = head;
+                head = object;
+            }
+            PushBatch(head, size);
+            count -= size;
+        }
+    }
+
+    // Called by `ObjectInPool` when the last reference goes.
+    void Release(T* object) {
+        ThreadCache* cache = GetThreadCache();
+        size_t size = cache->size.load(std::memory_order_relaxed);
+        if (size == kThreadCacheSize) {
+            // The cache is brought up to date before the full one is returned: deleting it runs
+            // destructors that may release more objects to this cache.
+            Node* full = std::exchange(cache->head, object);
+            object->next_free_ = nullptr;
+            cache->size.store(1, std::memory_order_relaxed);
+            ReturnBatch(full, size);
+            return;
+        }
+        object->next_free_ = cache->head;
+        cache->head = object;
+        cache->size.store(size + 1, std::memory_order_relaxed);
+    }
+
+    // Hands the free objects cached by this thread to the others.
+    void FlushThreadCache() {
+        ThreadCache* cache = GetThreadCache();
+        ReturnBatch(std::exchange(cache->head, nullptr),
+                    cache->size.exchange(0, std::memory_order_relaxed));
+    }
+
+    // Free objects in the global stack and every thread cache; exact only while no other thread
+    // uses the pool.
+    size_t NumAvailable() const {
+        size_t available = idle_.load(std::memory_order_relaxed);
+        std::lock_guard guard(caches_mutex_);
+        for (ThreadCache* cache = caches_; cache != nullptr; cache = cache->next) {
+            available += cache->size.load(std::memory_order_relaxed);
+        }
+        return available;
+    }
+
+    size_t NumInUse() const {
+        return allocated_.load(std::memory_order_relaxed) - NumAvailable();
+    }
+
+private:
+    using Node = ObjectInPool<T>;
+
+    struct ThreadCache {
+        // Only touched by the owner thread.
+        Node* head = nullptr;
+        // Written by the owner thread only, read by `NumAvailable`.
+        std::atomic<size_t> size = 0;
+        ThreadCache* next = nullptr;
+    };
+
+    // The caches of one thread, by pool. Entries of destroyed pools are never matched again, since
+    // ids are not reused, and are dropped from time to time.
+    struct ThreadCaches {
+        struct Entry {
+            uint64_t id;
+            ObjectPool* pool;
+            ThreadCache* cache;
+        };
+
+        static constexpr size_t kPruneThreshold = 8;
+
+        std::vector<Entry> entries;
+        size_t last = 0;
+
+        ~ThreadCaches() {
+            auto lock = ObjectPoolRegistry::Lock();
+            for (const Entry& entry : entries) {
+                if (ObjectPoolRegistry::IsLive(entry.id)) {
+                    entry.pool->RetireCache(entry.cache);
+                }
+            }
+        }
+
+        void Prune() {
+            auto lock = ObjectPoolRegistry::Lock();
+            std::erase_if(entries,
+                          [](const Entry& entry) { return !ObjectPoolRegistry::IsLive(entry.id); });
+        }
+    };
+
+    static inline thread_local ThreadCaches thread_caches;
+
+    const uint64_t id_ = ObjectPoolRegistry::Add();
+    const size_t max_idle_;
+    std::atomic<size_t> allocated_ = 0;
+    // Objects in `batches_`, counted before they are pushed and after they are popped.
+    std::atomic<size_t> idle_ = 0;
+    std::atomic<Node*> batches_ = nullptr;
+    std::mutex pop_mutex_;
+    mutable std::mutex caches_mutex_;
+    ThreadCache* caches_ = nullptr;
+
+    template <typename... Args>
+    T* New(Args&&... args) {
+        T* object = new T(std::forward<Args>(args)...);
+        RecordPointerAllocation<T>(sizeof(T));
+        object->home_ = this;
+        allocated_.fetch_add(1, std::memory_order_relaxed);
+        return object;
+    }
+
+    void DeleteChain(Node* head) {
+        while (head != nullptr) {
+            delete static_cast<T*>(std::exchange(head, head->next_free_));
+        }
+    }
+
+    ThreadCache* GetThreadCache() {
+        ThreadCaches& caches = thread_caches;
+        if (caches.last < caches.entries.size() && caches.entries[caches.last].id == id_) {
+            return caches.entries[caches.last].cache;
+        }
+        for (size_t i = 0; i < caches.entries.size(); ++i) {
+            if (caches.entries[i].id == id_) {
+                caches.last = i;
+                return caches.entries[i].cache;
+            }
+        }
+        if (caches.entries.size() >= ThreadCaches::kPruneThreshold) {
+            caches.Prune();
+        }
+        auto cache = new ThreadCache;
+        {
+            std::lock_guard guard(caches_mutex_);
+            cache->next = caches_;
+            caches_ = cache;
+        }
+        caches.entries.push_back({id_, this, cache});
+        caches.last = caches.entries.size() - 1;
+        return cache;
+    }
+
+    // Called with the registry locked when the thread that owns `cache` exits. Nothing is deleted
+    // here, since destructors could come back to a pool.
+    void RetireCache(ThreadCache* cache) {
+        if (cache->head != nullptr) {
+            PushBatch(cache->head, cache->size.load(std::memory_order_relaxed));
+        }
+        std::lock_guard guard(caches_mutex_);
+        ThreadCache** link = &caches_;
+        while (*link != cache) {
+            link = &(*link)->next;
+        }
+        *link = cache->next;
+        delete cache;
+    }
+
+    void Refill(ThreadCache* cache) {
+        Node* batch;
+        {
+            std::lock_guard guard(pop_mutex_);
+            batch = batches_.load(std::memory_order_acquire);
+            // Only pushes race with us, and they never remove `batch`.
+            while (batch != nullptr &&
+                   !batches_.compare_exchange_weak(batch, batch->next_batch_,
+                                                   std::memory_order_acquire,
+                                                   std::memory_order_acquire)) {
+            }
+        }
+        if (batch != nullptr) {
+            idle_.fetch_sub(batch->batch_size_, std::memory_order_relaxed);
+            cache->head = batch;
+            cache->size.store(batch->batch_size_, std::memory_order_relaxed);
+        }
+    }
+
+    // Pushes the chain at `head` to the global stack, or deletes it if that would exceed
+    // `max_idle_`.
+    void ReturnBatch(Node* head, size_t size) {
+        if (head == nullptr) {
+            return;
+        }
+        if (idle_.load(std::memory_order_relaxed) + size > max_idle_) {
+            allocated_.fetch_sub(size, std::memory_order_relaxed);
+            DeleteChain(head);
+            return;
+        }
+        PushBatch(head, size);
+    }
+
+    void PushBatch(Node* head, size_t size) {
+        head->batch_size_ = size;
+        idle_.fetch_add(size, std::memory_order_relaxed);
+        head->next_batch_ = batches_.load(std::memory_order_relaxed);
+        while (!batches_.compare_exchange_weak(head->next_batch_, head, std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+        }
+    }
+};
@@ -1,11 +1,15 @@
 #include "intrusive.h"
+#include "object_pool.h"
 
 #include <catch.hpp>
 
 #include "allocations_checker.h"
 
+#include <atomic>
 #include <string>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -264,81 +268,6 @@ TEST_CASE("No copies") {
     IntrusivePtr<Pinned> p(new Pinned(1));
 }
 
-template <typename T>
-class ObjectInPool;
-
-template <typename T>
-class ObjectPool {
-    static_assert(std::is_base_of_v<ObjectInPool<T>, T>, "Unsupported type");
-
-public:
-    template <typename... Args>
-    IntrusivePtr<T> Allocate(Args&&... args) {
-        if (!objects_.empty()) {
-            std::unique_ptr<T> ptr = std::move(objects_.back());
-            objects_.pop_back();
-            return IntrusivePtr<T>(ptr.release());
-        }
-        return DoAllocate(std::forward<Args>(args)...);
-    }
-
-    void Release(T* ptr) {
-        objects_.emplace_back(ptr);
-    }
-
-    size_t NumAvailable() const {
-        return objects_.size();
-    }
-
-    size_t NumInUse() const {
-        return allocated_ - NumAvailable();
-    }
-
-private:
-    template <typename... Args>
-    IntrusivePtr<T> DoAllocate(Args&&... args) {
-        ++allocated_;
-        std::unique_ptr<T> object = std::make_unique<T>(std::forward<Args>(args)...);
-        object->SetHome(this);
-        return IntrusivePtr<T>(object.release());
-    }
-
-private:
-    std::vector<std::unique_ptr<T>> objects_;
-    size_t allocated_ = 0;
-};
-
-template <typename Derived>
-class ObjectInPool {
-public:
-    void IncRef() {
-        count_++;
-    }
-
-    void DecRef() {
-        if (--count_ == 0) {
-            TakeMeHome();
-        }
-    }
-
-    size_t RefCount() const {
-        return count_;
-    }
-
-    void SetHome(ObjectPool<Derived>* pool) {
-        home_ = pool;
-    }
-
-private:
-    void TakeMeHome() {
-        home_->Release(static_cast<Derived*>(this));
-    }
-
-private:
-    size_t count_ = 0;
-    ObjectPool<Derived>* home_;
-};
-
 struct PoolableString : ObjectInPool<PoolableString>, std::string {
     using std::string::basic_string;
 };
@@ -387,3 +316,359 @@ TEST_CASE("Object pool") {
         REQUIRE(strs.NumInUse() == 1);
     }
 }
+
+struct PoolableNode : ObjectInPool<PoolableNode> {
+    IntrusivePtr<PoolableNode> child;
+};
+
+TEST_CASE("Object pool destructors") {
+    SECTION("Release into the pool") {
+        constexpr size_t kCacheSize = ObjectPool<PoolableNode>::kThreadCacheSize;
+        ObjectPool<PoolableNode> nodes(0);
+        {
+            std::vector<IntrusivePtr<PoolableNode>> held;
+            for (size_t i = 0; i <= kCacheSize; ++i) {
+                held.push_back(nodes.Allocate());
+                held.back()->child = nodes.Allocate();
+            }
+        }
+        // The last release overflowed the cache; the deleted nodes released their children.
+        REQUIRE(nodes.NumInUse() == 0);
+        size_t available = nodes.NumAvailable();
+        std::vector<IntrusivePtr<PoolableNode>> reused;
+        reused.reserve(available);
+        EXPECT_ZERO_ALLOCATIONS(for (size_t i = 0; i < available; ++i) {
+            reused.push_back(nodes.Allocate());
+        });
+    }
+}
+
+TEST_CASE("Object pool threads") {
+    SECTION("Prewarm") {
+        ObjectPool<PoolableString> strs;
+        strs.Prewarm(100, "warm");
+        REQUIRE(strs.NumAvailable() == 100);
+        // The first use on a thread sets up its cache.
+        REQUIRE(*strs.Allocate("cold") == "warm");
+        EXPECT_ZERO_ALLOCATIONS(auto a = strs.Allocate("cold"); auto b = strs.Allocate("cold");
+                                REQUIRE(*b == "warm"););
+        REQUIRE(strs.NumInUse() == 0);
+        REQUIRE(strs.NumAvailable() == 100);
+    }
+
+    SECTION("Capacity") {
+        constexpr size_t kCacheSize = ObjectPool<PoolableString>::kThreadCacheSize;
+        ObjectPool<PoolableString> strs(kCacheSize);
+        {
+            std::vector<IntrusivePtr<PoolableString>> held;
+            for (size_t i = 0; i < 4 * kCacheSize; ++i) {
+                held.push_back(strs.Allocate("x"));
+            }
+            REQUIRE(strs.NumInUse() == 4 * kCacheSize);
+        }
+        // One batch went to the global stack, one stays in the cache, the rest were deleted.
+        REQUIRE(strs.NumAvailable() == 2 * kCacheSize);
+        REQUIRE(strs.NumInUse() == 0);
+    }
+
+    SECTION("Returns from other threads") {
+        constexpr int kNumThreads = 4;
+        constexpr int kNumObjects = 1000;
+
+        ObjectPool<PoolableString> strs;
+        std::vector<IntrusivePtr<PoolableString>> objects;
+        for (int i = 0; i < kNumObjects; ++i) {
+            objects.push_back(strs.Allocate("object"));
+        }
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            std::vector<IntrusivePtr<PoolableString>> share;
+            for (int j = i; j < kNumObjects; j += kNumThreads) {
+                share.push_back(std::move(objects[j]));
+            }
+            threads.emplace_back([&strs, share = std::move(share)]() mutable {
+                for (int round = 0; round < 100; ++round) {
+                    auto extra = strs.Allocate("extra");
+                    extra.Reset();
+                }
+                share.clear();
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        // The threads handed their caches back when they exited.
+        REQUIRE(strs.NumInUse() == 0);
+        size_t available = strs.NumAvailable();
+        REQUIRE(available >= kNumObjects);
+        for (size_t i = 0; i < available; ++i) {
+            objects.push_back(strs.Allocate("more"));
+        }
+        REQUIRE(strs.NumAvailable() == 0);
+        REQUIRE(strs.NumInUse() == available);
+    }
+
+    SECTION("Flush") {
+        ObjectPool<PoolableString> strs;
+        strs.Allocate("flushed");
+        strs.FlushThreadCache();
+        REQUIRE(strs.NumAvailable() == 1);
+        std::string other;
+        std::thread([&] { other = *strs.Allocate("other"); }).join();
+        REQUIRE(other == "flushed");
+    }
+}
+
+// A C-style factory that hands out an already counted reference.
+MyInt* NewCountedInt(int value) {
+    return MakeIntrusive<MyInt>(value).Detach();
+}
+
+TEST_CASE("Adopt and detach") {
+    SECTION("Factory result") {
+        MyInt* raw = NewCountedInt(7);
+        REQUIRE(raw->RefCount() == 1);
+        IntrusivePtr<MyInt> p(raw, kAdoptRef);
+        REQUIRE(p.UseCount() == 1);
+        REQUIRE(p->value == 7);
+    }
+
+    SECTION("Across a queue") {
+        std::vector<MyString*> queue;
+        auto p = MakeIntrusive<MyString>("message");
+        auto q = p;
+        REQUIRE(p.UseCount() == 2);
+
+        queue.push_back(q.Detach());
+        REQUIRE(q.Get() == nullptr);
+        REQUIRE(q.UseCount() == 0);
+        REQUIRE(p.UseCount() == 2);
+
+        IntrusivePtr<MyString> r(queue.back(), kAdoptRef);
+        queue.pop_back();
+        REQUIRE(p.UseCount() == 2);
+        REQUIRE(*r == "message");
+
+        r.Reset();
+        REQUIRE(p.UseCount() == 1);
+    }
+
+    SECTION("Detach keeps the object alive") {
+        CountedString::ResetCounters();
+        CountedString* raw;
+        {
+            IntrusivePtr<CountedString> p(new CountedString("kept"));
+            raw = p.Detach();
+        }
+        REQUIRE(CountedString::NumAlive() == 1);
+        REQUIRE(raw->RefCount() == 1);
+        IntrusivePtr<CountedString>(raw, kAdoptRef).Reset();
+        REQUIRE(CountedString::NumAlive() == 0);
+    }
+
+    SECTION("Empty") {
+        IntrusivePtr<MyInt> p;
+        REQUIRE(p.Detach() == nullptr);
+        IntrusivePtr<MyInt> q(nullptr, kAdoptRef);
+        REQUIRE(!q);
+    }
+}
+
+struct SharedCounter : ThreadSafeRefCounted<SharedCounter> {
+    SharedCounter() {
+        alive.fetch_add(1);
+    }
+
+    ~SharedCounter() {
+        alive.fetch_sub(1);
+    }
+
+    static inline std::atomic<int> alive = 0;
+};
+
+TEST_CASE("Thread-safe counter") {
+    SECTION("Counts like the simple one") {
+        auto p = MakeIntrusive<SharedCounter>();
+        auto q = p;
+        REQUIRE(p.UseCount() == 2);
+        q.Reset();
+        REQUIRE(p.UseCount() == 1);
+        p.Reset();
+        REQUIRE(SharedCounter::alive == 0);
+    }
+
+    SECTION("Copies on many threads") {
+        constexpr int kNumThreads = 6;
+        constexpr int kNumIterations = 50'000;
+
+        auto counter = MakeIntrusive<SharedCounter>();
+        std::atomic<int> shared = 0;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([&counter, &shared] {
+                int seen = 0;
+                for (int j = 0; j < kNumIterations; ++j) {
+                    IntrusivePtr<SharedCounter> copy = counter;
+                    seen += copy.UseCount() >= 2;
+                }
+                shared.fetch_add(seen);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(shared == kNumThreads * kNumIterations);
+        REQUIRE(counter.UseCount() == 1);
+        counter.Reset();
+        REQUIRE(SharedCounter::alive == 0);
+    }
+}
+
+struct CountingDelete {
+    template <typename T>
+    static void DestroyObject(T* object) {
+        DefaultDelete::DestroyObject(object);
+    }
+
+    template <typename T>
+    static void Deallocate(void* memory) {
+        ++deallocated;
+        DefaultDelete::Deallocate<T>(memory);
+    }
+
+    static inline int deallocated = 0;
+};
+
+struct TreeNode : ObjectCounters<TreeNode>, WeakRefCounted<TreeNode, CountingDelete> {
+    IntrusiveWeakPtr<TreeNode> parent;
+    std::vector<IntrusivePtr<TreeNode>> children;
+};
+
+struct WeakBase : WeakRefCounted<WeakBase> {
+    virtual ~WeakBase() = default;
+};
+
+struct WeakDerived : WeakBase {
+    int value = 5;
+};
+
+struct Tag {
+    virtual ~Tag() = default;
+};
+
+// `WeakBase` does not start the object.
+struct WeakSecondBase : Tag, WeakBase {
+};
+
+TEST_CASE("Weak pointers") {
+    TreeNode::ResetCounters();
+    CountingDelete::deallocated = 0;
+
+    SECTION("Empty") {
+        IntrusiveWeakPtr<TreeNode> weak;
+        REQUIRE(weak.Expired());
+        REQUIRE(weak.UseCount() == 0);
+        REQUIRE(weak.Lock().Get() == nullptr);
+    }
+
+    SECTION("Lock") {
+        auto node = MakeIntrusive<TreeNode>();
+        IntrusiveWeakPtr<TreeNode> weak(node);
+        REQUIRE(node.UseCount() == 1);
+        {
+            auto locked = weak.Lock();
+            REQUIRE(locked.Get() == node.Get());
+            REQUIRE(node.UseCount() == 2);
+        }
+        REQUIRE(node.UseCount() == 1);
+        REQUIRE(!weak.Expired());
+    }
+
+    SECTION("Object dies first, memory last") {
+        IntrusiveWeakPtr<TreeNode> weak;
+        {
+            auto node = MakeIntrusive<TreeNode>();
+            weak = node;
+            IntrusiveWeakPtr<TreeNode> copy = weak;
+            REQUIRE(TreeNode::NumAlive() == 1);
+        }
+        REQUIRE(TreeNode::NumAlive() == 0);
+        REQUIRE(CountingDelete::deallocated == 0);
+        REQUIRE(weak.Expired());
+        REQUIRE(weak.Lock().Get() == nullptr);
+        weak.Reset();
+        REQUIRE(CountingDelete::deallocated == 1);
+    }
+
+    SECTION("No weak pointers") {
+        MakeIntrusive<TreeNode>();
+        REQUIRE(TreeNode::NumAlive() == 0);
+        REQUIRE(CountingDelete::deallocated == 1);
+    }
+
+    SECTION("Back-pointers do not leak") {
+        {
+            auto root = MakeIntrusive<TreeNode>();
+            for (int i = 0; i < 3; ++i) {
+                auto child = MakeIntrusive<TreeNode>();
+                child->parent = root;
+                root->children.push_back(child);
+            }
+            REQUIRE(root->children[2]->parent.Lock().Get() == root.Get());
+            REQUIRE(root.UseCount() == 1);
+        }
+        REQUIRE(TreeNode::NumCreated() == 4);
+        REQUIRE(TreeNode::NumAlive() == 0);
+        REQUIRE(CountingDelete::deallocated == 4);
+    }
+
+    SECTION("Conversions") {
+        IntrusivePtr<WeakDerived> derived = MakeIntrusive<WeakDerived>();
+        IntrusiveWeakPtr<WeakDerived> weak_derived(derived);
+        IntrusiveWeakPtr<WeakBase> weak_base(weak_derived);
+        IntrusiveWeakPtr<WeakBase> from_strong(derived);
+        REQUIRE(weak_base.Lock().Get() == derived.Get());
+        derived.Reset();
+        REQUIRE(from_strong.Expired());
+    }
+
+    SECTION("Base that does not start the object") {
+        IntrusiveWeakPtr<WeakBase> weak;
+        {
+            IntrusivePtr<WeakBase> base = MakeIntrusive<WeakSecondBase>();
+            REQUIRE(static_cast<void*>(base.Get()) != dynamic_cast<void*>(base.Get()));
+            weak = base;
+        }
+        REQUIRE(weak.Expired());
+        weak.Reset();
+    }
+}
+
+TEST_CASE("Weak pointers concurrent") {
+    constexpr int kNumThreads = 6;
+    constexpr int kNumRounds = 2'000;
+
+    TreeNode::ResetCounters();
+    CountingDelete::deallocated = 0;
+    std::atomic<int> locked_count = 0;
+    for (int round = 0; round < kNumRounds; ++round) {
+        auto node = MakeIntrusive<TreeNode>();
+        IntrusiveWeakPtr<TreeNode> weak(node);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([weak, &locked_count] {
+                if (auto locked = weak.Lock()) {
+                    IntrusiveWeakPtr<TreeNode> observer(locked);
+                    locked_count.fetch_add(1);
+                }
+            });
+        }
+        node.Reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    REQUIRE(TreeNode::NumAlive() == 0);
+    REQUIRE(CountingDelete::deallocated == kNumRounds);
+    REQUIRE(locked_count <= kNumThreads * kNumRounds);
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstdint>
+
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/atomic2
+// A `SharedPtr` that can be loaded, stored and compared-and-swapped from many threads at once,
+// lock-free wherever a 64-bit atomic is.
+//
+// The value lives in an immutable node (a `ControlBlockObj` holding the `SharedPtr`) and the
+// atomic word packs the node address in its low 48 bits with a "taken" count in the high 16 bits
+// (split reference counting). The strong count of a published node is charged in advance with
+// `kPrepaid` references; a reader takes one of them with a single `fetch_add` on the word, which
+// also keeps the node alive while the reader copies the value out. When half of the charge is
+// used up the reader that notices recharges the node and rebases the word. Whoever swaps the node
+// out of the word returns the references nobody took.
+//
+// Only for atomically counted pointers: the value is copied on whatever thread loads it.
+template <typename T>
+class AtomicSharedPtr {
+public:
+    static constexpr bool kIsAlwaysLockFree = std::atomic<uint64_t>::is_always_lock_free;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    AtomicSharedPtr() = default;
+
+    AtomicSharedPtr(SharedPtr<T> desired) : word_(Publish(std::move(desired))) {
+    }
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~AtomicSharedPtr() {
+        Retire(word_.load(std::memory_order_acquire));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Operations
+
+    SharedPtr<T> Load() const {
+        Node* node = Acquire();
+        if (node == nullptr) {
+            return SharedPtr<T>();
+        }
+        SharedPtr<T> value = *node->Get();
+        node->DecrementStrong();
+        return value;
+    }
+
+    void Store(SharedPtr<T> desired) {
+        Retire(word_.exchange(Publish(std::move(desired)), std::memory_order_acq_rel));
+    }
+
+    SharedPtr<T> Exchange(SharedPtr<T> desired) {
+        uint64_t old = word_.exchange(Publish(std::move(desired)), std::memory_order_acq_rel);
+        SharedPtr<T> value;
+        if (Node* node = NodeOf(old)) {
+            // Readers may still be copying the value, so it is copied rather than moved out.
+            value = *node->Get();
+        }
+        Retire(old);
+        return value;
+    }
+
+    // Replaces the value with `desired` if it owns the same object and points to the same address
+    // as `expected`; otherwise loads the current value into `expected`.
+    bool CompareExchange(SharedPtr<T>& expected, SharedPtr<T> desired) {
+        Node* next = nullptr;
+        while (true) {
+            Node* node = Acquire();
+            SharedPtr<T> current = node != nullptr ? *node->Get() : SharedPtr<T>();
+            if (current.Get() != expected.Get() || current.block_ != expected.block_) {
+                expected = std::move(current);
+                if (node != nullptr) {
+                    node->DecrementStrong();
+                }
+                if (next != nullptr) {
+                    next->ReleaseObject();
+                }
+                return false;
+            }
+            if (next == nullptr) {
+                next = NodeOf(Publish(std::move(desired)));
+            }
+            // Succeeds unless the node is swapped out meanwhile; the new node may hold the same
+            // value, hence the outer loop.
+            uint64_t word = word_.load(std::memory_order_relaxed);
+            bool exchanged = false;
+            while (NodeOf(word) == node && !exchanged) {
+                exchanged = word_.compare_exchange_weak(word, WordOf(next),
+                                                        std::memory_order_acq_rel,
+                                                        std::memory_order_relaxed);
+            }
+            if (node != nullptr) {
+                node->DecrementStrong();
+            }
+            if (exchanged) {
+                Retire(word);
+                return true;
+            }
+        }
+    }
+
+private:
+    using Node = ControlBlockObj<SharedPtr<T>>;
+
+    static constexpr int kPointerBits = 48;
+    static constexpr uint64_t kPointerMask = (uint64_t{1} << kPointerBits) - 1;
+    static constexpr uint64_t kTakenOne = uint64_t{1} << kPointerBits;
+    // At most 2^16 - 1 references taken at a time, half of them while a recharge is in flight.
+    static constexpr uint32_t kPrepaid = 1 << 15;
+
+    static_assert(sizeof(void*) == sizeof(uint64_t), "Node addresses are packed in 64 bits");
+
+    // The taken count of a null word is meaningless and wraps around harmlessly.
+    mutable std::atomic<uint64_t> word_ = 0;
+
+    static Node* NodeOf(uint64_t word) {
+        return reinterpret_cast<Node*>(word & kPointerMask);
+    }
+
+    static uint64_t WordOf(Node* node) {
+        return reinterpret_cast<uint64_t>(node);
+    }
+
+    // An empty pointer is stored as a null word, anything else gets a fresh node owned by the word
+    // and charged for the readers.
+    static uint64_t Publish(SharedPtr<T> desired) {
+        if (desired.Get() == nullptr && desired.block_ == nullptr) {
+            return 0;
+        }
+        auto node = new Node(std::move(desired));
+        node->counts.fetch_add(kPrepaid * ControlBlock::kStrongOne, std::memory_order_relaxed);
+        return WordOf(node);
+    }
+
+    // Returns the current node with one strong reference held, or null.
+    Node* Acquire() const {
+        uint64_t word = word_.fetch_add(kTakenOne, std::memory_order_acquire);
+        Node* node = NodeOf(word);
+        if (node == nullptr) {
+            return nullptr;
+        }
+        uint64_t taken = word >> kPointerBits;
+        if (taken >= kPrepaid) {
+            // Every prepaid reference is in use: pay for our own.
+            Recharge(node, 1);
+        } else if (taken == kPrepaid / 2) {
+            Recharge(node, kPrepaid / 2);
+        }
+        return node;
+    }
+
+    // Adds `count` references to the charge of `node` and takes them off the taken count. If the
+    // node has been swapped out meanwhile the swap settled the count, so the references go back.
+    void Recharge(Node* node, uint64_t count) const {
+        node->counts.fetch_add(count * ControlBlock::kStrongOne, std::memory_order_relaxed);
+        uint64_t word = word_.load(std::memory_order_relaxed);
+        while (NodeOf(word) == node) {
+            if (word_.compare_exchange_weak(word, word - count * kTakenOne,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        node->counts.fetch_sub(count * ControlBlock::kStrongOne, std::memory_order_relaxed);
+    }
+
+    // Drops the reference of the word and the references nobody took. More may have been taken
+    // than were charged, in which case the difference is added instead.
+    static void Retire(uint64_t word) {
+        Node* node = NodeOf(word);
+        if (node == nullptr) {
+            return;
+        }
+        // Wraps around when negative, like the strong half of the counts does.
+        uint64_t unused = uint64_t{1 + kPrepaid} - (word >> kPointerBits);
+        uint64_t counts = node->counts.fetch_sub(unused, std::memory_order_acq_rel);
+        if (ControlBlock::Strong(counts) == static_cast<uint32_t>(unused)) {
+            node->ReleaseObject();
+        }
+    }
+};
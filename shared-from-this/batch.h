@@ -0,0 +1,39 @@
+#pragma once
+
+#include "shared.h"
+
+#if !SHARED_PTR_REFCOUNT_BATCH
+#error "RefcountBatchScope needs SHARED_PTR_REFCOUNT_BATCH defined to 1 in every translation unit"
+#endif
+
+// Deferred reference counting for loops that keep copying and dropping pointers to the same few
+// objects, such as handing one message to many subscribers.
+//
+// Inside the scope, dropping an atomically counted strong reference only logs it in a per-thread
+// `RefcountBatch`, and copying a pointer whose block has a logged release takes that release back.
+// The net releases are applied when the scope closes or the log fills up. Until then objects may
+// outlive their last pointer, `UseCount()` includes the pending releases and `WeakPtr::Expired()`
+// may still say false. Scopes on one thread nest; the outermost one owns the log. Pointers only
+// look for a scope when the program is built with `SHARED_PTR_REFCOUNT_BATCH` (sw_fwd.h).
+class RefcountBatchScope {
+public:
+    RefcountBatchScope() {
+        if (RefcountBatch::current == nullptr) {
+            RefcountBatch::current = &batch_;
+        }
+    }
+
+    RefcountBatchScope(const RefcountBatchScope&) = delete;
+    RefcountBatchScope& operator=(const RefcountBatchScope&) = delete;
+
+    ~RefcountBatchScope() {
+        if (RefcountBatch::current == &batch_) {
+            // Objects destroyed now release their references directly.
+            RefcountBatch::current = nullptr;
+            batch_.Flush();
+        }
+    }
+
+private:
+    RefcountBatch batch_;
+};
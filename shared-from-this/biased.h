@@ -0,0 +1,400 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// Biased reference counting (Choi, Shull, Torrellas, "Biased Reference Counting", PACT'18).
+//
+// A block created by a `BiasedCounting` pointer is biased towards the creating thread: the owner
+// counts its strong references in `BiasedBlockOps::biased` with plain loads and stores, every
+// other thread uses the atomic shared count in `ControlBlock::counts`. The object is alive while
+// the sum of both is positive, so the shared count alone may go negative when a reference made by
+// the owner is dropped elsewhere. Such a block is queued to the owner, which merges the two counts
+// the next time it calls `BiasedCounting::ProcessQueue()` (also done on every new biased block and
+// at thread exit).
+//
+// For biased blocks the strong half of `ControlBlock::counts` holds the shared count shifted left
+// by two, with a "merged" and a "queued" flag in the low bits, plus `kZero` so that the count can
+// go negative without borrowing from the weak half. After the merge the block is counted
+// atomically by everybody. Only the strong count is biased: weak references always use atomics.
+// The biased count and the owner id live in a `BiasedBlockOps`, so that blocks of the other
+// policies do not carry them. `MakeShared` puts it in the same allocation as the block and the
+// object; blocks made elsewhere (adopted pointers, deleters, allocators, arrays) allocate it
+// separately.
+
+template <typename T>
+using BiasedSharedPtr = SharedPtr<T, BiasedCounting>;
+
+template <typename T>
+using BiasedWeakPtr = WeakPtr<T, BiasedCounting>;
+
+struct BiasedOwner;
+
+// Maps owner ids to owners. Ids are handed out again once their owner is gone.
+class BiasedOwners {
+public:
+    static uint32_t Add(BiasedOwner* owner) {
+        std::lock_guard guard(mutex);
+        uint32_t id;
+        if (!free_ids.empty()) {
+            id = free_ids.back();
+            free_ids.pop_back();
+        } else if (next_id < kChunks * kChunkSize) {
+            id = next_id++;
+        } else {
+            throw std::length_error("Too many threads own biased blocks");
+        }
+        auto& chunk = chunks[id / kChunkSize];
+        if (chunk.load(std::memory_order_relaxed) == nullptr) {
+            chunk.store(new std::atomic<BiasedOwner*>[kChunkSize](), std::memory_order_release);
+        }
+        chunk.load(std::memory_order_relaxed)[id % kChunkSize].store(owner,
+                                                                     std::memory_order_release);
+        return id;
+    }
+
+    static void Remove(uint32_t id) {
+        std::lock_guard guard(mutex);
+        free_ids.push_back(id);
+    }
+
+    // `id` must be held by a live owner.
+    static BiasedOwner* Get(uint32_t id) {
+        return chunks[id / kChunkSize].load(std::memory_order_acquire)[id % kChunkSize].load(
+            std::memory_order_acquire);
+    }
+
+private:
+    static constexpr uint32_t kChunkSize = 1024;
+    static constexpr uint32_t kChunks = 1024;
+
+    static inline std::atomic<std::atomic<BiasedOwner*>*> chunks[kChunks] = {};
+    static inline std::mutex mutex;
+    static inline std::vector<uint32_t> free_ids;
+    // 0 means no owner.
+    static inline uint32_t next_id = 1;
+};
+
+// Per-thread state. Kept alive by the thread itself and by every block biased towards it that has
+// not been merged yet.
+struct BiasedOwner {
+    uint32_t id = BiasedOwners::Add(this);
+    std::atomic<size_t> refs = 1;
+    std::atomic<bool> has_queued = false;
+    std::mutex mutex;
+    // Guarded by `mutex`.
+    bool alive = true;
+    std::vector<ControlBlock*> queue;
+
+    void Release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            BiasedOwners::Remove(id);
+            delete this;
+        }
+    }
+};
+
+// A copy of the ops table of a biased block, which points to it instead of the static one, with
+// the state only biased blocks need.
+struct BiasedBlockOps : ControlBlockOps {
+    const ControlBlockOps* base;
+    // Strong references counted by the owner thread without atomics.
+    mutable std::atomic<uint32_t> biased = 0;
+    // The id of the thread `biased` belongs to (see `BiasedOwners`), 0 once the counts are merged.
+    mutable std::atomic<uint32_t> owner = 0;
+
+    explicit BiasedBlockOps(const ControlBlockOps& block_ops)
+        : ControlBlockOps(block_ops), base(&block_ops) {
+    }
+
+    // A table of its own for a block that has no room for one, freed together with the block.
+    static BiasedBlockOps* New(const ControlBlockOps& block_ops) {
+        auto ops = new BiasedBlockOps(block_ops);
+        RecordPointerAllocation<BiasedBlockOps>(sizeof(BiasedBlockOps));
+        ops->deallocate = &Deallocate;
+        ops->dispose = &Dispose;
+        return ops;
+    }
+
+    static const BiasedBlockOps& Of(const ControlBlock& block) {
+        return static_cast<const BiasedBlockOps&>(*block.ops);
+    }
+
+private:
+    static void Deallocate(ControlBlock* block) {
+        const BiasedBlockOps* ops = &Of(*block);
+        ops->base->deallocate(block);
+        delete ops;
+    }
+
+    static void Dispose(ControlBlock* block) {
+        const BiasedBlockOps* ops = &Of(*block);
+        ops->base->dispose(block);
+        delete ops;
+    }
+};
+
+// What `MakeShared` allocates for `BiasedCounting` pointers: the table goes with the block and the
+// object, which it is freed with.
+template <typename T>
+struct BiasedControlBlockObj : ControlBlockObj<T> {
+    BiasedBlockOps biased_ops;
+
+    template <typename... Args>
+    BiasedControlBlockObj(Args&&... args)
+        : ControlBlockObj<T>(std::forward<Args>(args)...),
+          biased_ops(ControlBlockManager<BiasedControlBlockObj>::kOps) {
+    }
+};
+
+template <typename T>
+struct SharedObjectBlock<T, BiasedCounting> {
+    using Type = BiasedControlBlockObj<T>;
+};
+
+struct BiasedCounting {
+    static constexpr bool kLocal = false;
+
+    static constexpr uint64_t kMerged = 1;
+    static constexpr uint64_t kQueued = 2;
+    static constexpr uint64_t kOne = 4;
+    static constexpr uint64_t kZero = uint64_t{1} << 31;
+
+    static void Init(ControlBlock& block) {
+        Bias(block, *BiasedBlockOps::New(*block.ops));
+    }
+
+    template <typename T>
+    static void Init(BiasedControlBlockObj<T>& block) {
+        Bias(block, block.biased_ops);
+    }
+
+    static void IncrementStrong(ControlBlock& block) {
+        if (IsOwner(block)) {
+            AddBiased(block, 1);
+        } else {
+            block.counts.fetch_add(kOne, std::memory_order_relaxed);
+        }
+    }
+
+    // May succeed on a block whose owner has not yet reconciled a release made elsewhere, but
+    // never on a block whose object is already destroyed: that only happens after the merge.
+    static bool IncrementStrongIfNotZero(ControlBlock& block) {
+        if (IsOwner(block) && (block.counts.load(std::memory_order_relaxed) & kQueued) != 0) {
+            // Make the answer exact for the owner.
+            ProcessQueue();
+        }
+        if (IsOwner(block)) {
+            AddBiased(block, 1);
+            return true;
+        }
+        uint64_t value = block.counts.load(std::memory_order_relaxed);
+        while (true) {
+            int32_t total = Count(value);
+            if ((value & kMerged) == 0) {
+                total += static_cast<int32_t>(
+                    BiasedBlockOps::Of(block).biased.load(std::memory_order_relaxed));
+            }
+            if (total <= 0) {
+                return false;
+            }
+            if (block.counts.compare_exchange_weak(value, value + kOne, std::memory_order_acq_rel,
+                                                   std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    static StrongRelease DecrementStrong(ControlBlock& block) {
+        return ReleasesObject(block) ? StrongRelease::kObject : StrongRelease::kNone;
+    }
+
+    static void IncrementWeak(ControlBlock& block) {
+        AtomicCounting::IncrementWeak(block);
+    }
+
+    static bool DecrementWeak(ControlBlock& block) {
+        return AtomicCounting::DecrementWeak(block);
+    }
+
+    static size_t UseCount(const ControlBlock& block) {
+        uint64_t value = block.counts.load(std::memory_order_relaxed);
+        int32_t total = Count(value);
+        if ((value & kMerged) == 0) {
+            total += static_cast<int32_t>(
+                BiasedBlockOps::Of(block).biased.load(std::memory_order_relaxed));
+        }
+        return total > 0 ? total : 0;
+    }
+
+    // Merges the counts of every block whose shared count went negative on another thread, and
+    // destroys the objects that turn out to be unreferenced.
+    static void ProcessQueue() {
+        BiasedOwner* owner = CurrentOwner();
+        if (owner == nullptr) {
+            return;
+        }
+        std::vector<ControlBlock*> queue;
+        {
+            std::lock_guard guard(owner->mutex);
+            queue.swap(owner->queue);
+            owner->has_queued.store(false, std::memory_order_relaxed);
+        }
+        for (ControlBlock* block : queue) {
+            if (Drain(owner, *block)) {
+                block->ReleaseObject<BiasedCounting>();
+            }
+        }
+    }
+
+private:
+    struct ThreadExit {
+        ~ThreadExit() {
+            BiasedOwner* owner = current;
+            // From now on this thread counts like any other one, so blocks still biased towards
+            // it can be merged by whoever queues them.
+            current = nullptr;
+            std::vector<ControlBlock*> queue;
+            {
+                std::lock_guard guard(owner->mutex);
+                owner->alive = false;
+                queue.swap(owner->queue);
+            }
+            for (ControlBlock* block : queue) {
+                if (Drain(owner, *block)) {
+                    block->ReleaseObject<BiasedCounting>();
+                }
+            }
+            owner->Release();
+        }
+    };
+
+    static inline thread_local BiasedOwner* current = nullptr;
+
+    static BiasedOwner* CurrentOwner() {
+        return current;
+    }
+
+    // Biases `block` towards this thread, with the state in `ops`.
+    static void Bias(ControlBlock& block, BiasedBlockOps& ops) {
+        BiasedOwner* owner = CurrentOwner();
+        if (owner == nullptr) {
+            owner = StartThread();
+        } else if (owner->has_queued.load(std::memory_order_relaxed)) {
+            ProcessQueue();
+        }
+        owner->refs.fetch_add(1, std::memory_order_relaxed);
+        ops.owner.store(owner->id, std::memory_order_relaxed);
+        uint64_t counts = block.counts.load(std::memory_order_relaxed);
+        ops.biased.store(ControlBlock::Strong(counts), std::memory_order_relaxed);
+        block.counts.store(counts - ControlBlock::Strong(counts) + kZero,
+                           std::memory_order_relaxed);
+        block.ops = &ops;
+        block.Track<BiasedCounting>();
+    }
+
+    static BiasedOwner* StartThread() {
+        static thread_local ThreadExit exit;
+        current = new BiasedOwner;
+        return current;
+    }
+
+    static bool IsOwner(const ControlBlock& block) {
+        BiasedOwner* owner = current;
+        return owner != nullptr &&
+               BiasedBlockOps::Of(block).owner.load(std::memory_order_relaxed) == owner->id;
+    }
+
+    static int32_t Count(uint64_t value) {
+        return static_cast<int32_t>(ControlBlock::Strong(value) - kZero) >> 2;
+    }
+
+    // Returns true when the object has to be destroyed.
+    static bool ReleasesObject(ControlBlock& block) {
+        if (IsOwner(block)) {
+            if (AddBiased(block, -1) != 0) {
+                return false;
+            }
+            return MergeOwned(block);
+        }
+
+        uint64_t value = block.counts.load(std::memory_order_relaxed);
+        while (true) {
+            if ((value & kMerged) != 0) {
+                uint64_t next = block.counts.fetch_sub(kOne, std::memory_order_acq_rel) - kOne;
+                // A queued block is freed by whoever drains it.
+                return Count(next) == 0 && (next & kQueued) == 0;
+            }
+            // Read before the exchange: if the block is merged in between, the exchange fails. No
+            // owner means the owner is merging right now and will account for this release.
+            uint32_t owner = BiasedBlockOps::Of(block).owner.load(std::memory_order_acquire);
+            uint64_t next = value - kOne;
+            bool enqueue = owner != 0 && Count(next) < 0 && (value & kQueued) == 0;
+            if (enqueue) {
+                next |= kQueued;
+            }
+            if (block.counts.compare_exchange_weak(value, next, std::memory_order_acq_rel,
+                                                   std::memory_order_relaxed)) {
+                // While the block is queued it keeps its owner alive.
+                return enqueue && Enqueue(BiasedOwners::Get(owner), block);
+            }
+        }
+    }
+
+    static uint32_t AddBiased(ControlBlock& block, uint32_t delta) {
+        auto& biased = BiasedBlockOps::Of(block).biased;
+        uint32_t value = biased.load(std::memory_order_relaxed) + delta;
+        biased.store(value, std::memory_order_relaxed);
+        return value;
+    }
+
+    // The owner dropped its last biased reference: from now on the block is counted atomically.
+    // Once the merged flag is published another thread may free the block, so it is not touched
+    // afterwards.
+    static bool MergeOwned(ControlBlock& block) {
+        BiasedOwner* owner = current;
+        BiasedBlockOps::Of(block).owner.store(0, std::memory_order_release);
+        uint64_t value = block.counts.fetch_or(kMerged, std::memory_order_acq_rel);
+        if ((value & kQueued) != 0) {
+            // The drain releases the owner and decides.
+            return false;
+        }
+        owner->Release();
+        return Count(value) == 0;
+    }
+
+    // Takes a queued block off `owner`'s hands: merges the counts unless the owner already did.
+    // Runs on the owner thread, or anywhere once the owner has exited.
+    static bool Drain(BiasedOwner* owner, ControlBlock& block) {
+        const BiasedBlockOps& ops = BiasedBlockOps::Of(block);
+        uint64_t biased = ops.biased.load(std::memory_order_relaxed);
+        ops.owner.store(0, std::memory_order_release);
+        uint64_t value = block.counts.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            next = value & ~kQueued;
+            if ((value & kMerged) == 0) {
+                next = (next + biased * kOne) | kMerged;
+            }
+        } while (!block.counts.compare_exchange_weak(value, next, std::memory_order_acq_rel,
+                                                     std::memory_order_relaxed));
+        owner->Release();
+        return Count(next) == 0;
+    }
+
+    static bool Enqueue(BiasedOwner* owner, ControlBlock& block) {
+        {
+            std::lock_guard guard(owner->mutex);
+            if (owner->alive) {
+                owner->queue.push_back(&block);
+                owner->has_queued.store(true, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        // The owner has exited, its biased count is final.
+        return Drain(owner, block);
+    }
+};
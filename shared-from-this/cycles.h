@@ -0,0 +1,271 @@
+#pragma once
+
+#include "shared.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Synchronous cycle collection by trial deletion (Bacon and Rajan, "Concurrent Cycle Collection in
+// Reference Counted Systems", ECOOP 2001; Lins, "Cyclic Reference Counting with Lazy Mark-Scan",
+// 1992).
+//
+// Objects opt in by defining `void Trace(CycleTracer& tracer)`, which passes every `SharedPtr`
+// member to `tracer`. When a release leaves such an object with other strong references, its block
+// becomes a candidate root of a garbage cycle, buffered on the releasing thread (`CycleRoots` in
+// sw_fwd.h). Releases never walk anything, but they are not free either: every release of a
+// traceable object looks the block up in the thread's hash set of candidates and updates the counts
+// with a compare-and-swap loop instead of a single fetch_sub; a block not buffered yet is inserted,
+// which may allocate. `CycleCollector::Collect()` later takes a batch of candidates and walks the
+// objects they reach. It copies their strong counts, subtracts the references they hold to one
+// another and keeps whatever is left with a reference from outside, together with everything that
+// reaches. The rest is only referenced from within: garbage. The collector clears the references
+// among the garbage objects, after which they go the usual way.
+//
+// The collector holds a strong reference to every object it walks, and reads the counts only once
+// all of them are walked. A release or `WeakPtr::Lock()` of a walked object marks its block as
+// changed. If any object found to be garbage changed, the trial proves nothing: the candidates are
+// buffered again and nothing is freed. Garbage is marked before its references are cleared, so
+// that `Lock()` cannot revive it. Other threads may therefore copy, release and lock references
+// to the objects while a collection runs, but must not assign their `SharedPtr` members. One
+// collection runs at a time. Biased pointers are not supported, local ones only on their thread.
+
+// Passed to `Trace`; visits one strong edge per call.
+class CycleTracer {
+public:
+    template <typename T, typename Counting>
+    void operator()(SharedPtr<T, Counting>& ptr) {
+        static_assert(!std::is_same_v<Counting, BiasedCounting>,
+                      "Biased pointers do not take part in cycle collection");
+        if (ptr.block_ != nullptr && visit_(context_, ptr.block_)) {
+            ptr.Reset();
+        }
+    }
+
+private:
+    // Returns whether the edge is to be cleared.
+    using Visit = bool (*)(void* context, ControlBlock* target);
+
+    Visit visit_;
+    void* context_;
+
+    CycleTracer(Visit visit, void* context) : visit_(visit), context_(context) {
+    }
+
+    friend class CycleCollector;
+};
+
+class CycleCollector {
+public:
+    // Looks for garbage cycles through at most `max_roots` of the candidates buffered on this
+    // thread, frees them and returns the number of objects freed. Call it where the latency does
+    // not matter; a bounded `max_roots` spreads the work over several calls.
+    static size_t Collect(size_t max_roots = SIZE_MAX) {
+        return CollectRoots(CycleRoots::Take(max_roots));
+    }
+
+    // Candidates buffered on this thread.
+    static size_t NumCandidates() {
+        return CycleRoots::Size();
+    }
+
+private:
+    static constexpr size_t kNone = SIZE_MAX;
+
+    enum class Color {
+        // Walked, trial count not settled.
+        kGray,
+        // Referenced from outside the walked objects, directly or not.
+        kBlack,
+        // Garbage.
+        kWhite,
+    };
+
+    struct Node {
+        ControlBlock* block;
+        // The strong count less the references from other walked objects and the collector.
+        int64_t trial_count;
+        Color color;
+        std::vector<size_t> children;
+    };
+
+    struct Graph {
+        std::vector<Node> nodes;
+        std::unordered_map<ControlBlock*, size_t> index;
+
+        // The node of `block`, walked on first sight; `kNone` if it cannot be walked.
+        size_t Add(ControlBlock* block) {
+            auto [it, inserted] = index.emplace(block, nodes.size());
+            if (inserted) {
+                if (!Walk(block)) {
+                    index.erase(it);
+                    return kNone;
+                }
+                nodes.push_back({block, 0, Color::kGray, {}});
+            }
+            return it->second;
+        }
+    };
+
+    static inline std::mutex mutex;
+
+    static size_t CollectRoots(const std::vector<ControlBlock*>& roots) {
+        std::unique_lock lock(mutex);
+        Graph graph;
+        for (ControlBlock* block : roots) {
+            // The buffer's weak reference kept the block; the object may be gone already.
+            graph.Add(block);
+        }
+        MarkGray(graph);
+        for (Node& node : graph.nodes) {
+            uint64_t counts = node.block->counts.load(std::memory_order_seq_cst);
+            node.trial_count += int64_t{ControlBlock::Strong(counts)} - 1;
+        }
+        Scan(graph);
+        bool collected = Doom(graph);
+        if (collected) {
+            ClearWhiteEdges(graph);
+        }
+        for (const Node& node : graph.nodes) {
+            if (node.color == Color::kBlack) {
+                node.block->counts.fetch_and(~(ControlBlock::kWalked | ControlBlock::kDirty),
+                                             std::memory_order_relaxed);
+            }
+        }
+        lock.unlock();
+
+        for (ControlBlock* block : roots) {
+            // A root `Walk` refused is gone or garbage another collection frees: nothing to retry.
+            if (!collected && graph.index.contains(block)) {
+                CycleRoots::Restore(block);
+            } else {
+                block->DecrementWeak();
+            }
+        }
+        // Garbage goes with the last reference, which is the collector's.
+        size_t freed = 0;
+        for (const Node& node : graph.nodes) {
+            freed += node.color == Color::kWhite;
+            node.block->ReleaseTraced(false);
+        }
+        return freed;
+    }
+
+    // Takes a strong reference for the collector and marks the block walked, in one step, unless
+    // the object is gone or is garbage that another collection is freeing.
+    static bool Walk(ControlBlock* block) {
+        uint64_t counts = block->counts.load(std::memory_order_relaxed);
+        while (ControlBlock::Strong(counts) != 0 && (counts & ControlBlock::kDoomed) == 0) {
+            uint64_t next = (counts + ControlBlock::kStrongOne) | ControlBlock::kWalked;
+            if (block->counts.compare_exchange_weak(counts, next, std::memory_order_seq_cst,
+                                                    std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Walks everything traceable the roots reach, subtracting each edge from its target.
+    static void MarkGray(Graph& graph) {
+        struct Context {
+            Graph* graph;
+            size_t node;
+        };
+        for (size_t i = 0; i < graph.nodes.size(); ++i) {
+            Context context{&graph, i};
+            CycleTracer tracer(
+                [](void* context, ControlBlock* target) {
+                    auto [graph, node] = *static_cast<Context*>(context);
+                    if (target->ops->trace != nullptr) {
+                        size_t child = graph->Add(target);
+                        if (child != kNone) {
+                            graph->nodes[node].children.push_back(child);
+                            --graph->nodes[child].trial_count;
+                        }
+                    }
+                    return false;
+                },
+                &context);
+            ControlBlock* block = graph.nodes[i].block;
+            block->ops->trace(block, tracer);
+        }
+    }
+
+    // Turns black whatever an outside reference keeps alive, white the rest.
+    static void Scan(Graph& graph) {
+        std::vector<size_t> stack;
+        for (size_t i = 0; i < graph.nodes.size(); ++i) {
+            if (graph.nodes[i].trial_count > 0 && graph.nodes[i].color == Color::kGray) {
+                graph.nodes[i].color = Color::kBlack;
+                stack.push_back(i);
+            }
+            while (!stack.empty()) {
+                size_t node = stack.back();
+                stack.pop_back();
+                for (size_t child : graph.nodes[node].children) {
+                    if (graph.nodes[child].color != Color::kBlack) {
+                        graph.nodes[child].color = Color::kBlack;
+                        stack.push_back(child);
+                    }
+                }
+            }
+        }
+        for (Node& node : graph.nodes) {
+            if (node.color == Color::kGray) {
+                node.color = Color::kWhite;
+            }
+        }
+    }
+
+    // Stops `Lock()` from reviving the white objects, or turns every node black and returns false
+    // if one of them changed while walked. Changes to black objects do not matter: whatever a
+    // thread reached from one of them is black too.
+    static bool Doom(Graph& graph) {
+        for (size_t i = 0; i < graph.nodes.size(); ++i) {
+            if (graph.nodes[i].color != Color::kWhite) {
+                continue;
+            }
+            std::atomic<uint64_t>& counts = graph.nodes[i].block->counts;
+            uint64_t old = counts.load(std::memory_order_relaxed);
+            do {
+                if ((old & ControlBlock::kDirty) != 0) {
+                    for (size_t j = 0; j < i; ++j) {
+                        graph.nodes[j].block->counts.fetch_and(~ControlBlock::kDoomed,
+                                                               std::memory_order_relaxed);
+                    }
+                    for (Node& node : graph.nodes) {
+                        node.color = Color::kBlack;
+                    }
+                    return false;
+                }
+            } while (!counts.compare_exchange_weak(old, old | ControlBlock::kDoomed,
+                                                   std::memory_order_seq_cst,
+                                                   std::memory_order_relaxed));
+        }
+        return true;
+    }
+
+    // Clears the edges among the white objects, after which each one is only referenced by the
+    // collector.
+    static void ClearWhiteEdges(Graph& graph) {
+        CycleTracer tracer(
+            [](void* context, ControlBlock* target) {
+                auto graph = static_cast<Graph*>(context);
+                auto it = graph->index.find(target);
+                return it != graph->index.end() &&
+                       graph->nodes[it->second].color == Color::kWhite;
+            },
+            &graph);
+        // The cleared edges leave the collector's references, no candidates. Releases from the
+        // destructors later on may leave other cycles behind and are buffered as usual.
+        CycleRoots::SetCollecting(true);
+        for (const Node& node : graph.nodes) {
+            if (node.color == Color::kWhite) {
+                node.block->ops->trace(node.block, tracer);
+            }
+        }
+        CycleRoots::SetCollecting(false);
+    }
+};
@@ -0,0 +1,269 @@
+#pragma once
+
+#include "shared.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Hazard pointers (Michael, "Hazard Pointers: Safe Memory Reclamation for Lock-Free Objects",
+// IEEE TPDS 2004) on top of `ControlBlock`.
+//
+// A reader publishes the address of a control block in a hazard slot of its own and then checks
+// that the block is still reachable; from then on the block cannot lose the strong reference it
+// was reached through. Writers do not drop such references directly: they retire them with
+// `HazardDomain::Retire`, and the reference is dropped (and the object destroyed, if it was the
+// last one) once no hazard points to the block. Readers never write to a shared cache line, so
+// borrowing scales with the number of cores where copying a `SharedPtr` does not.
+
+// A hazard slot. One per cache line, so that readers do not invalidate each other's lines.
+struct alignas(64) HazardRecord {
+    std::atomic<const void*> hazard = nullptr;
+    std::atomic<bool> in_use = true;
+    HazardRecord* next = nullptr;
+};
+
+// The process-wide set of hazard slots and retired references.
+class HazardDomain {
+public:
+    // Retires one strong reference of `block`.
+    static void Retire(ControlBlock* block) {
+        State& state = GetState();
+        size_t threshold = kScanThreshold + 2 * state.records_count.load(std::memory_order_relaxed);
+        {
+            std::lock_guard guard(state.mutex);
+            state.retired.push_back(block);
+            if (state.retired.size() < threshold) {
+                return;
+            }
+        }
+        Reclaim();
+    }
+
+    // Drops every retired reference that is not protected right now.
+    static void Reclaim() {
+        State& state = GetState();
+        std::vector<ControlBlock*> retired;
+        {
+            std::lock_guard guard(state.mutex);
+            retired.swap(state.retired);
+        }
+        // Pairs with the fence in `HazardPointer::Protect`: either the reader sees the block
+        // unreachable and retries, or we see its hazard.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<const void*> hazards;
+        for (HazardRecord* record = state.records.load(std::memory_order_acquire);
+             record != nullptr; record = record->next) {
+            if (const void* hazard = record->hazard.load(std::memory_order_acquire)) {
+                hazards.push_back(hazard);
+            }
+        }
+        std::sort(hazards.begin(), hazards.end());
+
+        std::vector<ControlBlock*> protected_blocks;
+        for (ControlBlock* block : retired) {
+            if (std::binary_search(hazards.begin(), hazards.end(), block)) {
+                protected_blocks.push_back(block);
+            } else {
+                // May destroy objects that retire references of their own, so not under the lock.
+                block->DecrementStrong();
+            }
+        }
+        if (!protected_blocks.empty()) {
+            std::lock_guard guard(state.mutex);
+            state.retired.insert(state.retired.end(), protected_blocks.begin(),
+                                 protected_blocks.end());
+        }
+    }
+
+    static HazardRecord* AcquireRecord() {
+        std::vector<HazardRecord*>& cache = thread_records.free;
+        if (!cache.empty()) {
+            HazardRecord* record = cache.back();
+            cache.pop_back();
+            return record;
+        }
+        State& state = GetState();
+        for (HazardRecord* record = state.records.load(std::memory_order_acquire);
+             record != nullptr; record = record->next) {
+            bool in_use = false;
+            if (!record->in_use.load(std::memory_order_relaxed) &&
+                record->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire)) {
+                return record;
+            }
+        }
+        auto record = new HazardRecord;
+        record->next = state.records.load(std::memory_order_relaxed);
+        while (!state.records.compare_exchange_weak(record->next, record,
+                                                    std::memory_order_release,
+                                                    std::memory_order_relaxed)) {
+        }
+        state.records_count.fetch_add(1, std::memory_order_relaxed);
+        return record;
+    }
+
+    // Keeps the record for the next hazard of this thread.
+    static void ReleaseRecord(HazardRecord* record) {
+        record->hazard.store(nullptr, std::memory_order_release);
+        thread_records.free.push_back(record);
+    }
+
+private:
+    static constexpr size_t kScanThreshold = 64;
+
+    struct State {
+        // Records are never freed, only handed over to other threads.
+        std::atomic<HazardRecord*> records = nullptr;
+        std::atomic<size_t> records_count = 0;
+        std::mutex mutex;
+        std::vector<ControlBlock*> retired;
+
+        ~State() {
+            // No reader is left at exit.
+            for (ControlBlock* block : retired) {
+                block->DecrementStrong();
+            }
+        }
+    };
+
+    // Records owned by a thread, returned to the domain when it exits.
+    struct ThreadRecords {
+        std::vector<HazardRecord*> free;
+
+        ~ThreadRecords() {
+            for (HazardRecord* record : free) {
+                record->in_use.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    static inline thread_local ThreadRecords thread_records;
+
+    static State& GetState() {
+        static State state;
+        return state;
+    }
+};
+
+// A hazard slot held by one reader.
+class HazardPointer {
+public:
+    HazardPointer() : record_(HazardDomain::AcquireRecord()) {
+    }
+
+    HazardPointer(HazardPointer&& other) : record_(std::exchange(other.record_, nullptr)) {
+    }
+
+    HazardPointer& operator=(HazardPointer&&) = delete;
+
+    ~HazardPointer() {
+        if (record_ != nullptr) {
+            HazardDomain::ReleaseRecord(record_);
+        }
+    }
+
+    // Loads `source` and protects the block it points to until the next `Protect` or `Reset`.
+    // `Block` is a control block type.
+    template <typename Block>
+    Block* Protect(const std::atomic<Block*>& source) {
+        Block* block = source.load(std::memory_order_relaxed);
+        while (true) {
+            record_->hazard.store(static_cast<const ControlBlock*>(block),
+                                  std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            Block* reloaded = source.load(std::memory_order_acquire);
+            if (reloaded == block) {
+                return block;
+            }
+            block = reloaded;
+        }
+    }
+
+    void Reset() {
+        record_->hazard.store(nullptr, std::memory_order_release);
+    }
+
+private:
+    HazardRecord* record_;
+};
+
+// Access to the object of a `HazardCell` without touching its reference counts.
+template <typename T>
+class HazardGuard {
+public:
+    T* Get() const {
+        return ptr_;
+    }
+    T& operator*() const {
+        return *ptr_;
+    }
+    T* operator->() const {
+        return ptr_;
+    }
+    explicit operator bool() const {
+        return ptr_ != nullptr;
+    }
+
+private:
+    HazardPointer hazard_;
+    T* ptr_ = nullptr;
+
+    template <typename Y>
+    friend class HazardCell;
+};
+
+// A published `SharedPtr` whose readers borrow the object under a hazard pointer. The value lives
+// in a node (a `ControlBlockObj` holding the `SharedPtr`), which is what the hazard protects;
+// replacing the value retires the only reference to the old node.
+template <typename T>
+class HazardCell {
+public:
+    HazardCell() = default;
+
+    explicit HazardCell(SharedPtr<T> value) : node_(NewNode(std::move(value))) {
+    }
+
+    HazardCell(const HazardCell&) = delete;
+    HazardCell& operator=(const HazardCell&) = delete;
+
+    ~HazardCell() {
+        if (Node* node = node_.load(std::memory_order_acquire)) {
+            HazardDomain::Retire(node);
+        }
+    }
+
+    // Valid while the guard lives, even if the value is replaced meanwhile.
+    HazardGuard<T> Borrow() const {
+        HazardGuard<T> guard;
+        if (Node* node = guard.hazard_.Protect(node_)) {
+            guard.ptr_ = node->Get()->Get();
+        }
+        return guard;
+    }
+
+    SharedPtr<T> Load() const {
+        HazardPointer hazard;
+        Node* node = hazard.Protect(node_);
+        return node != nullptr ? *node->Get() : SharedPtr<T>();
+    }
+
+    void Store(SharedPtr<T> value) {
+        Node* old = node_.exchange(NewNode(std::move(value)), std::memory_order_acq_rel);
+        if (old != nullptr) {
+            HazardDomain::Retire(old);
+        }
+    }
+
+private:
+    using Node = ControlBlockObj<SharedPtr<T>>;
+
+    std::atomic<Node*> node_ = nullptr;
+
+    static Node* NewNode(SharedPtr<T> value) {
+        if (!value) {
+            return nullptr;
+        }
+        return new Node(std::move(value));
+    }
+};
@@ -5,27 +5,48 @@
 #include <cstddef>  // std::nullptr_t
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
-template <typename T>
+// `Counting` picks how the counts of the control block are updated (see `AtomicCounting` and
+// `LocalCounting` in sw_fwd.h). `T` may be an array type, `T[]` or `T[N]`: such pointers point to
+// the first element and provide `operator[]` instead of `operator*` and `operator->`.
+template <typename T, typename Counting>
 class SharedPtr {
 public:
+    using ElementType = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
     SharedPtr() = default;
     SharedPtr(std::nullptr_t) : ptr_(nullptr), block_(nullptr){};
 
-    explicit SharedPtr(T* ptr) : ptr_(ptr), block_(new ControlBlockPtr<T>(ptr)){
+    // Arrays take the template below, which rejects pointers to derived elements.
+    explicit SharedPtr(ElementType* ptr)
+        requires(!std::is_array_v<T>)
+        : ptr_(ptr), block_(NewPtrBlock(ptr)){
         if constexpr (std::is_convertible_v<T*, EnableSharedFromThisBase*>) {
             InitWeakThis(ptr);
         }
     };
 
     template <typename Y>
-    explicit SharedPtr(Y* ptr) : ptr_(ptr), block_(new ControlBlockPtr<Y>(ptr)){};
+        requires OwnablePointer<Y, T>
+    explicit SharedPtr(Y* ptr) : ptr_(ptr), block_(NewPtrBlock(ptr)){
+        if constexpr (std::is_convertible_v<Y*, EnableSharedFromThisBase*>) {
+            InitWeakThis(ptr);
+        }
+    };
+
+    // #4 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
+    // A control block in place of the deleter means adopting a reference (see below).
+    template <typename Y, typename Deleter>
+        requires(OwnablePointer<Y, T> && !std::is_convertible_v<Deleter, ControlBlock*>)
+    SharedPtr(Y* ptr, Deleter deleter)
+        : ptr_(ptr),
+          block_(NewDeleterBlock(ptr, std::move(deleter))){};
 
     SharedPtr(const SharedPtr& other) : ptr_(other.ptr_), block_(other.block_) {
         if (block_ != nullptr) {
-            block_->IncrementStrong();
+            block_->IncrementStrong<Counting>();
         }
     };
 
@@ -35,18 +56,37 @@ public:
     };
 
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other) : ptr_(other.ptr_), block_(other.block_) {
+        requires CompatiblePointer<Y, T>
+    SharedPtr(const SharedPtr<Y, Counting>& other) : ptr_(other.ptr_), block_(other.block_) {
         if (block_ != nullptr) {
-            block_->IncrementStrong();
+            block_->IncrementStrong<Counting>();
         }
     };
 
     template <typename Y>
-    SharedPtr(SharedPtr<Y>&& other) : ptr_(other.ptr_), block_(other.block_) {
+        requires CompatiblePointer<Y, T>
+    SharedPtr(SharedPtr<Y, Counting>&& other) : ptr_(other.ptr_), block_(other.block_) {
         other.ptr_ = nullptr;
         other.block_ = nullptr;
     };
 
+    // Conversion between counting policies, explicit so that the policy never changes silently.
+    // A local block handed to an atomically counted pointer stops being local for good.
+    template <typename Y, typename OtherCounting>
+        requires CompatiblePointer<Y, T>
+    explicit SharedPtr(const SharedPtr<Y, OtherCounting>& other)
+        : ptr_(other.ptr_), block_(other.block_) {
+        static_assert(!std::is_same_v<Counting, BiasedCounting> &&
+                          !std::is_same_v<OtherCounting, BiasedCounting>,
+                      "Biased blocks are only ever counted by BiasedCounting pointers");
+        if (block_ != nullptr) {
+            if (!Counting::kLocal && block_->IsLocal()) {
+                block_->EndLocal();
+            }
+            block_->IncrementStrong<Counting>();
+        }
+    };
+
     SharedPtr(ControlBlockObj<T>* block) : block_(block) {
         ptr_ = block->Get();
         if constexpr (std::is_convertible_v<T*, EnableSharedFromThisBase*>) {
@@ -54,7 +94,7 @@ public:
         }
     }
 
-    SharedPtr(T* ptr, ControlBlock* block) : ptr_(ptr), block_(block) {
+    SharedPtr(ElementType* ptr, ControlBlock* block) : ptr_(ptr), block_(block) {
         if constexpr (std::is_convertible_v<T*, EnableSharedFromThisBase*>) {
             InitWeakThis(ptr);
         }
@@ -63,81 +103,79 @@ public:
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) : ptr_(ptr), block_(other.block_) {
+    SharedPtr(const SharedPtr<Y, Counting>& other, ElementType* ptr)
+        : ptr_(ptr), block_(other.block_) {
         if (block_ != nullptr) {
-            block_->IncrementStrong();
+            block_->IncrementStrong<Counting>();
         }
     };
 
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
-    explicit SharedPtr(const WeakPtr<T>& other) {
-        if (other.Expired()) {
+    explicit SharedPtr(const WeakPtr<T, Counting>& other) {
+        *this = other.Lock();
+        if (block_ == nullptr) {
             throw BadWeakPtr();
         }
-        *this = other.Lock();
     };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // `operator=`-s
 
     SharedPtr& operator=(const SharedPtr& other) {
-        if (this->Get() == (&other)->Get()) {
+        if (ptr_ == other.ptr_ && block_ == other.block_) {
             return *this;
         }
-        if (block_ != nullptr) {
-            block_->DecrementStrong();
-        }
+        // The old reference goes last: it may be what keeps `other` alive.
+        ControlBlock* old = std::exchange(block_, other.block_);
         ptr_ = other.ptr_;
-        block_ = other.block_;
         if (block_ != nullptr) {
-            block_->IncrementStrong();
+            block_->IncrementStrong<Counting>();
+        }
+        if (old != nullptr) {
+            old->DecrementStrong<Counting>();
         }
         return *this;
     };
 
     template <typename Y>
-    SharedPtr& operator=(const SharedPtr<Y>& other) {
-        if (this->Get() == (&other)->Get()) {
+        requires CompatiblePointer<Y, T>
+    SharedPtr& operator=(const SharedPtr<Y, Counting>& other) {
+        if (ptr_ == other.ptr_ && block_ == other.block_) {
             return *this;
         }
-        if (block_ != nullptr) {
-            block_->DecrementStrong();
-        }
+        // The old reference goes last: it may be what keeps `other` alive.
+        ControlBlock* old = std::exchange(block_, other.block_);
         ptr_ = other.ptr_;
-        block_ = other.block_;
         if (block_ != nullptr) {
-            block_->IncrementStrong();
+            block_->IncrementStrong<Counting>();
+        }
+        if (old != nullptr) {
+            old->DecrementStrong<Counting>();
         }
         return *this;
     };
 
     SharedPtr& operator=(SharedPtr&& other) {
-        if (this->Get() == (&other)->Get()) {
+        if (this == &other) {
             return *this;
         }
-        if (block_ != nullptr) {
-            block_->DecrementStrong();
+        ControlBlock* old = std::exchange(block_, std::exchange(other.block_, nullptr));
+        ptr_ = std::exchange(other.ptr_, nullptr);
+        if (old != nullptr) {
+            old->DecrementStrong<Counting>();
         }
-        ptr_ = other.ptr_;
-        block_ = other.block_;
-        other.ptr_ = nullptr;
-        other.block_ = nullptr;
         return *this;
     };
 
     template <typename Y>
-    SharedPtr& operator=(SharedPtr<Y>&& other) {
-        if (this->Get() == (&other)->Get()) {
-            return *this;
-        }
-        if (block_ != nullptr) {
-            block_->DecrementStrong();
+        requires CompatiblePointer<Y, T>
+    SharedPtr& operator=(SharedPtr<Y, Counting>&& other) {
+        ControlBlock* old = std::exchange(block_, std::exchange(other.block_, nullptr));
+        ptr_ = std::exchange(other.ptr_, nullptr);
+        if (old != nullptr) {
+            old->DecrementStrong<Counting>();
         }
-        ptr_ = other.ptr_;
-        block_ = other.block_;
-        other.ptr_ = nullptr;
-        other.block_ = nullptr;
         return *this;
     };
 
@@ -146,7 +184,7 @@ public:
 
     ~SharedPtr() {
         if (block_ != nullptr) {
-            block_->DecrementStrong();
+            block_->DecrementStrong<Counting>();
         }
     };
 
@@ -155,19 +193,29 @@ public:
 
     void Reset() {
         if (block_ != nullptr) {
-            block_->DecrementStrong();
+            block_->DecrementStrong<Counting>();
         }
         ptr_ = nullptr;
         block_ = nullptr;
     };
 
     template <typename Y>
+        requires OwnablePointer<Y, T>
     void Reset(Y* ptr) {
         if (block_ != nullptr) {
-            block_->DecrementStrong();
+            block_->DecrementStrong<Counting>();
         }
         ptr_ = ptr;
-        block_ = new ControlBlockPtr<Y>(ptr);
+        block_ = NewPtrBlock(ptr);
+    };
+    template <typename Y, typename Deleter>
+        requires OwnablePointer<Y, T>
+    void Reset(Y* ptr, Deleter deleter) {
+        if (block_ != nullptr) {
+            block_->DecrementStrong<Counting>();
+        }
+        ptr_ = ptr;
+        block_ = NewDeleterBlock(ptr, std::move(deleter));
     };
     void Swap(SharedPtr& other) {
         std::swap(ptr_, other.ptr_);
@@ -177,62 +225,216 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T* Get() const {
+    ElementType* Get() const {
         return ptr_;
     };
-    T& operator*() const {
+    T& operator*() const
+        requires(!std::is_array_v<T>)
+    {
         return *ptr_;
     };
-    T* operator->() const {
+    T* operator->() const
+        requires(!std::is_array_v<T>)
+    {
         return ptr_;
     };
+    ElementType& operator[](std::ptrdiff_t index) const
+        requires std::is_array_v<T>
+    {
+        return ptr_[index];
+    };
     size_t UseCount() const {
         if (block_ == nullptr) {
             return 0;
         }
-        return block_->strong;
+        return block_->UseCount<Counting>();
     };
     explicit operator bool() const {
         return ptr_ != nullptr;
     };
 
 private:
-    T* ptr_ = nullptr;
+    ElementType* ptr_ = nullptr;
     ControlBlock* block_ = nullptr;
 
-    template <typename Y>
+    template <typename Y, typename OtherCounting>
     friend class SharedPtr;
 
-    template <typename Y>
+    template <typename Y, typename OtherCounting>
     friend class WeakPtr;
 
     template <typename Y>
     friend class EnableSharedFromThis;
 
+    template <typename Y>
+    friend class AtomicSharedPtr;
+
+    friend class CycleTracer;
+
+    static ControlBlock* NewBlock(ControlBlock* block) {
+        Counting::Init(*block);
+        return block;
+    }
+
+    // Arrays made with `new[]` are freed with `delete[]`.
+    template <typename Y>
+    static ControlBlock* NewPtrBlock(Y* ptr) {
+        if constexpr (std::is_array_v<T>) {
+            return NewDeleterBlock(ptr, std::default_delete<Y[]>());
+        } else {
+            auto block = new ControlBlockPtr<Y>(ptr);
+            RecordPointerAllocation<Y>(sizeof(*block));
+            return NewBlock(block);
+        }
+    }
+
+    template <typename Y, typename Deleter>
+    static ControlBlock* NewDeleterBlock(Y* ptr, Deleter deleter) {
+        auto block = new ControlBlockDeleter<Y, Deleter>(ptr, std::move(deleter));
+        RecordPointerAllocation<Y>(sizeof(*block));
+        return NewBlock(block);
+    }
+
+    // Only the first owner of the object fills in `weak_this_`. The weak pointer there is
+    // atomically counted, so the owner must be too.
     template <typename Y>
     void InitWeakThis(EnableSharedFromThis<Y>* e) {
-        e->weak_this = *this;
+        static_assert(std::is_same_v<Counting, AtomicCounting>,
+                      "EnableSharedFromThis objects need atomically counted owners");
+        if (e->weak_this_.Expired()) {
+            e->weak_this_ = SharedPtr<Y>(*this, ptr_);
+        }
     }
 
 };
 
-template <typename T, typename U>
-inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
+template <typename T, typename TCounting, typename U, typename UCounting>
+inline bool operator==(const SharedPtr<T, TCounting>& left, const SharedPtr<U, UCounting>& right) {
     return left.Get() == right.Get();
 };
 
-// Allocate memory only once
+// Allocate memory only once, unless the object is large enough to be worth giving back before the
+// weak pointers to it are gone. The object is `T(args...)`, or default-initialized
+// `kDefaultInit`.
+template <typename T, typename Counting, bool kDefaultInit, typename... Args>
+SharedPtr<T, Counting> NewSharedObject(Args&&... args) {
+    if constexpr (sizeof(T) >= kSplitStorageThreshold) {
+        std::unique_ptr<T> object;
+        if constexpr (kDefaultInit) {
+            object.reset(new T);
+        } else {
+            object.reset(new T(std::forward<Args>(args)...));
+        }
+        auto block = new ControlBlockPtr<T>(object.get());
+        RecordPointerAllocation<T>(sizeof(T));
+        RecordPointerAllocation<T>(sizeof(*block));
+        Counting::Init(*block);
+        return SharedPtr<T, Counting>(object.release(), static_cast<ControlBlock*>(block));
+    } else {
+        using Block = typename SharedObjectBlock<T, Counting>::Type;
+        Block* block;
+        if constexpr (kDefaultInit) {
+            block = new Block(kForOverwrite);
+        } else {
+            block = new Block(std::forward<Args>(args)...);
+        }
+        RecordPointerAllocation<T>(sizeof(*block));
+        Counting::Init(*block);
+        return SharedPtr<T, Counting>(block);
+    }
+};
+
+template <typename T, typename Counting = AtomicCounting, typename... Args>
+    requires(!std::is_array_v<T>)
+SharedPtr<T, Counting> MakeShared(Args&&... args) {
+    return NewSharedObject<T, Counting, false>(std::forward<Args>(args)...);
+};
+
+// Like `MakeShared`, but the block is allocated and freed through `allocator`
+template <typename T, typename Counting = AtomicCounting, typename Allocator, typename... Args>
+SharedPtr<T, Counting> AllocateShared(const Allocator& allocator, Args&&... args) {
+    using Block = ControlBlockAlloc<T, Allocator>;
+    using Traits = std::allocator_traits<typename Block::BlockAllocator>;
+    typename Block::BlockAllocator block_allocator(allocator);
+    Block* block = Traits::allocate(block_allocator, 1);
+    try {
+        new (block) Block(block_allocator, std::forward<Args>(args)...);
+    } catch (...) {
+        Traits::deallocate(block_allocator, block, 1);
+        throw;
+    }
+    RecordPointerAllocation<T>(sizeof(Block));
+    Counting::Init(*block);
+    return SharedPtr<T, Counting>(block->Get(), static_cast<ControlBlock*>(block));
+};
+
+// `size` value-initialized elements, aligned to `alignment` (a power of two), allocated together
+// with the block
+template <typename T, typename Counting = AtomicCounting>
+    requires std::is_unbounded_array_v<T>
+SharedPtr<T, Counting> MakeSharedAligned(size_t size, size_t alignment) {
+    auto block = ControlBlockArray<std::remove_extent_t<T>>::Create(size, alignment);
+    Counting::Init(*block);
+    return SharedPtr<T, Counting>(block->Get(), static_cast<ControlBlock*>(block));
+};
+
+template <typename T, typename Counting = AtomicCounting>
+    requires std::is_bounded_array_v<T>
+SharedPtr<T, Counting> MakeSharedAligned(size_t alignment) {
+    auto block = ControlBlockArray<std::remove_extent_t<T>>::Create(std::extent_v<T>, alignment);
+    Counting::Init(*block);
+    return SharedPtr<T, Counting>(block->Get(), static_cast<ControlBlock*>(block));
+};
+
+// Arrays are aligned to a cache line so that SIMD code can load the elements directly
+template <typename T, typename Counting = AtomicCounting>
+    requires std::is_unbounded_array_v<T>
+SharedPtr<T, Counting> MakeShared(size_t size) {
+    return MakeSharedAligned<T, Counting>(size, kArrayAlignment);
+};
+
+template <typename T, typename Counting = AtomicCounting>
+    requires std::is_bounded_array_v<T>
+SharedPtr<T, Counting> MakeShared() {
+    return MakeSharedAligned<T, Counting>(kArrayAlignment);
+};
+
+// Like `MakeShared`, but the object is default-initialized: storage that is about to be
+// overwritten is not zeroed first
+template <typename T, typename Counting = AtomicCounting>
+    requires(!std::is_array_v<T>)
+SharedPtr<T, Counting> MakeSharedForOverwrite() {
+    return NewSharedObject<T, Counting, true>();
+};
+
+template <typename T, typename Counting = AtomicCounting>
+    requires std::is_unbounded_array_v<T>
+SharedPtr<T, Counting> MakeSharedForOverwrite(size_t size) {
+    using Block = ControlBlockArray<std::remove_extent_t<T>>;
+    auto block = Block::template Create<true>(size, kArrayAlignment);
+    Counting::Init(*block);
+    return SharedPtr<T, Counting>(block->Get(), static_cast<ControlBlock*>(block));
+};
+
+template <typename T, typename Counting = AtomicCounting>
+    requires std::is_bounded_array_v<T>
+SharedPtr<T, Counting> MakeSharedForOverwrite() {
+    using Block = ControlBlockArray<std::remove_extent_t<T>>;
+    auto block = Block::template Create<true>(std::extent_v<T>, kArrayAlignment);
+    Counting::Init(*block);
+    return SharedPtr<T, Counting>(block->Get(), static_cast<ControlBlock*>(block));
+};
+
 template <typename T, typename... Args>
-SharedPtr<T> MakeShared(Args&&... args) {
-    auto block = new ControlBlockObj<T>(std::forward<Args>(args)...);
-    return SharedPtr<T>(block);
+LocalSharedPtr<T> MakeLocalShared(Args&&... args) {
+    return MakeShared<T, LocalCounting>(std::forward<Args>(args)...);
 };
 
 class EnableSharedFromThisBase {
 };
 // Look for usage examples in tests
 template <typename T>
-class EnableSharedFromThis : EnableSharedFromThisBase {
+class EnableSharedFromThis : public EnableSharedFromThisBase {
 public:
     SharedPtr<T> SharedFromThis() {
         return SharedPtr(weak_this_);
@@ -248,6 +450,18 @@ public:
         return WeakPtr<const T>(weak_this_);
     };
 
+protected:
+    EnableSharedFromThis() = default;
+    // Copies belong to whoever owns them, not to the owners of the original.
+    EnableSharedFromThis(const EnableSharedFromThis&) {
+    }
+    EnableSharedFromThis& operator=(const EnableSharedFromThis&) {
+        return *this;
+    }
+
 private:
     WeakPtr<T> weak_this_;
+
+    template <typename Y, typename Counting>
+    friend class SharedPtr;
 };
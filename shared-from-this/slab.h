@@ -0,0 +1,294 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+
+// Size-class slabs for control blocks (Bonwick, "The Slab Allocator", USENIX 1994), with a
+// magazine of free blocks per thread and size class in front of them (Bonwick and Adams,
+// "Magazines and Vmem", USENIX 2001) and remote-free lists for blocks released on other threads
+// (Leijen et al., "Mimalloc: Free List Sharding in Action", 2019).
+//
+// Every slab is `kSlabSize` bytes aligned to its size, so a block finds its slab by masking its
+// address. A slab belongs to the heap of the thread that created it. That thread allocates and
+// frees its blocks through its magazines without atomics; other threads push the blocks they free
+// onto the slab's remote list, which the owner takes over in one exchange when it runs out of free
+// blocks. When a thread exits its heap abandons the slabs that still have blocks out, and the last
+// of those blocks to be freed frees the slab.
+class SlabAllocator {
+public:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxSize = 256;
+    static constexpr size_t kSlabSize = 64 << 10;
+    static constexpr size_t kMagazineSize = 64;
+
+    // `size` must be at most `kMaxSize`; blocks are aligned to `kGranularity`.
+    static void* Allocate(size_t size) {
+        size_t index = ClassOf(size);
+        Heap* heap = thread_heap;
+        if (heap != nullptr) {
+            Magazine& magazine = heap->magazines[index];
+            if (FreeBlock* block = magazine.head) {
+                magazine.head = block->next;
+                --magazine.size;
+                return block;
+            }
+        } else if (thread_exited) {
+            return AllocateOrphan(index);
+        } else {
+            heap = NewThreadHeap();
+        }
+        return heap->AllocateFromSlab(index);
+    }
+
+    // `size` must be the size `block` was allocated with.
+    static void Deallocate(void* block, [[maybe_unused]] size_t size) {
+        Slab* slab = SlabOf(block);
+        Heap* heap = thread_heap;
+        if (heap != nullptr && slab->owner.load(std::memory_order_relaxed) == heap) {
+            Magazine& magazine = heap->magazines[slab->size_class];
+            if (magazine.size == kMagazineSize) {
+                heap->FlushMagazine(slab->size_class, kMagazineSize / 2);
+            }
+            auto free_block = static_cast<FreeBlock*>(block);
+            free_block->next = magazine.head;
+            magazine.head = free_block;
+            ++magazine.size;
+            return;
+        }
+        slab->FreeRemote(static_cast<FreeBlock*>(block));
+    }
+
+private:
+    static constexpr size_t kNumClasses = kMaxSize / kGranularity;
+    // The remote list of a slab whose owner is gone.
+    static constexpr uintptr_t kAbandoned = 1;
+
+    struct Heap;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    // The header at the start of every slab.
+    struct Slab {
+        static constexpr size_t kHeaderSize = 128;
+
+        // Null once the owner has abandoned the slab.
+        std::atomic<Heap*> owner;
+        const uint32_t size_class;
+        const uint32_t block_size;
+
+        // Owner only.
+        FreeBlock* free = nullptr;
+        char* bump;
+        char* const end;
+        // Blocks out of the slab, in magazines included.
+        size_t used = 0;
+        Slab* next = nullptr;
+
+        // Blocks freed by other threads, or `kAbandoned`. Away from the owner's fields, which
+        // remote frees would otherwise keep invalidating.
+        alignas(64) std::atomic<uintptr_t> remote = 0;
+        // Once abandoned: blocks out, less those freed since. Goes negative when frees overtake
+        // the abandoning thread.
+        std::atomic<int64_t> abandoned_used = 0;
+
+        Slab(Heap* heap, size_t index)
+            : owner(heap),
+              size_class(static_cast<uint32_t>(index)),
+              block_size(static_cast<uint32_t>((index + 1) * kGranularity)),
+              bump(reinterpret_cast<char*>(this) + kHeaderSize),
+              end(reinterpret_cast<char*>(this) + kSlabSize) {
+        }
+
+        static Slab* New(Heap* heap, size_t index) {
+            void* memory = ::operator new(kSlabSize, std::align_val_t{kSlabSize});
+            return new (memory) Slab(heap, index);
+        }
+
+        void Delete() {
+            this->~Slab();
+            ::operator delete(this, std::align_val_t{kSlabSize});
+        }
+
+        // Owner only: a free block, or null if the slab is full.
+        void* Take() {
+            if (free == nullptr && remote.load(std::memory_order_relaxed) != 0) {
+                CollectRemote();
+            }
+            if (FreeBlock* block = free) {
+                free = block->next;
+                ++used;
+                return block;
+            }
+            if (end - bump >= static_cast<ptrdiff_t>(block_size)) {
+                ++used;
+                return std::exchange(bump, bump + block_size);
+            }
+            return nullptr;
+        }
+
+        // Owner only.
+        void Put(FreeBlock* block) {
+            block->next = free;
+            free = block;
+            --used;
+        }
+
+        // Owner only: moves the remote list to the local one.
+        void CollectRemote() {
+            uintptr_t head = remote.exchange(0, std::memory_order_acquire);
+            auto block = reinterpret_cast<FreeBlock*>(head);
+            while (block != nullptr) {
+                Put(std::exchange(block, block->next));
+            }
+        }
+
+        void FreeRemote(FreeBlock* block) {
+            uintptr_t head = remote.load(std::memory_order_relaxed);
+            do {
+                if (head == kAbandoned) {
+                    if (abandoned_used.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        Delete();
+                    }
+                    return;
+                }
+                block->next = reinterpret_cast<FreeBlock*>(head);
+            } while (!remote.compare_exchange_weak(head, reinterpret_cast<uintptr_t>(block),
+                                                   std::memory_order_release,
+                                                   std::memory_order_relaxed));
+        }
+
+        // Owner only, when its thread exits.
+        void Abandon() {
+            auto block = reinterpret_cast<FreeBlock*>(
+                remote.exchange(kAbandoned, std::memory_order_acq_rel));
+            while (block != nullptr) {
+                Put(std::exchange(block, block->next));
+            }
+            owner.store(nullptr, std::memory_order_relaxed);
+            auto out = static_cast<int64_t>(used);
+            if (abandoned_used.fetch_add(out, std::memory_order_acq_rel) + out == 0) {
+                Delete();
+            }
+        }
+    };
+
+    static_assert(sizeof(Slab) <= Slab::kHeaderSize);
+
+    struct Magazine {
+        FreeBlock* head = nullptr;
+        size_t size = 0;
+    };
+
+    struct SizeClass {
+        Slab* current = nullptr;
+        Slab* slabs = nullptr;
+    };
+
+    struct Heap {
+        Magazine magazines[kNumClasses];
+        SizeClass classes[kNumClasses];
+
+        void* AllocateFromSlab(size_t index) {
+            SizeClass& size_class = classes[index];
+            if (size_class.current != nullptr) {
+                if (void* block = size_class.current->Take()) {
+                    return block;
+                }
+            }
+            for (Slab* slab = size_class.slabs; slab != nullptr; slab = slab->next) {
+                if (slab == size_class.current) {
+                    continue;
+                }
+                if (void* block = slab->Take()) {
+                    size_class.current = slab;
+                    return block;
+                }
+            }
+            Slab* slab = Slab::New(this, index);
+            slab->next = size_class.slabs;
+            size_class.slabs = slab;
+            size_class.current = slab;
+            return slab->Take();
+        }
+
+        // Returns `count` blocks of the magazine to their slabs, freeing the slabs that become
+        // empty unless they are current.
+        void FlushMagazine(size_t index, size_t count) {
+            Magazine& magazine = magazines[index];
+            for (; count > 0 && magazine.head != nullptr; --count, --magazine.size) {
+                FreeBlock* block = std::exchange(magazine.head, magazine.head->next);
+                Slab* slab = SlabOf(block);
+                slab->Put(block);
+                if (slab->used == 0 && slab != classes[index].current) {
+                    Unlink(index, slab);
+                    slab->Delete();
+                }
+            }
+        }
+
+        void Unlink(size_t index, Slab* slab) {
+            Slab** link = &classes[index].slabs;
+            while (*link != slab) {
+                link = &(*link)->next;
+            }
+            *link = slab->next;
+        }
+
+        ~Heap() {
+            for (size_t index = 0; index < kNumClasses; ++index) {
+                Magazine& magazine = magazines[index];
+                while (FreeBlock* block = magazine.head) {
+                    magazine.head = block->next;
+                    SlabOf(block)->Put(block);
+                }
+                for (Slab* slab = classes[index].slabs; slab != nullptr;) {
+                    std::exchange(slab, slab->next)->Abandon();
+                }
+            }
+        }
+    };
+
+    // Abandons the heap of the thread when it exits.
+    struct ThreadExit {
+        Heap* heap = nullptr;
+
+        ~ThreadExit() {
+            thread_exited = true;
+            thread_heap = nullptr;
+            delete heap;
+        }
+    };
+
+    static inline thread_local Heap* thread_heap = nullptr;
+    static inline thread_local bool thread_exited = false;
+
+    static size_t ClassOf(size_t size) {
+        return size == 0 ? 0 : (size - 1) / kGranularity;
+    }
+
+    static Slab* SlabOf(void* block) {
+        return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(block) & ~(kSlabSize - 1));
+    }
+
+    static Heap* NewThreadHeap() {
+        static thread_local ThreadExit thread_exit;
+        thread_exit.heap = new Heap;
+        thread_heap = thread_exit.heap;
+        return thread_heap;
+    }
+
+    // Blocks allocated by threads whose heap is already gone (from destructors of other
+    // thread-locals) come from a shared heap that is never abandoned; they are all freed remotely.
+    static void* AllocateOrphan(size_t index) {
+        static std::mutex mutex;
+        static Heap* orphans = new Heap;
+        std::lock_guard guard(mutex);
+        return orphans->AllocateFromSlab(index);
+    }
+};
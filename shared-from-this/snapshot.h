@@ -0,0 +1,275 @@
+#pragma once
+
+#include "shared.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Read-copy-update with epoch-based grace periods (McKenney, "Read-Copy Update", OLS 2001;
+// Fraser, "Practical lock-freedom", 2004).
+//
+// A reader announces the global epoch it started in and then reads the current version without
+// touching its reference counts. A writer swaps in a new version and retires the reference the
+// cell held to the old one, tagged with a fresh epoch; the reference is dropped once every reader
+// has either left or started in that epoch or later, so none of them can still see the old
+// version. A reader that is stuck delays reclamation, never other readers or writers.
+
+// Per-thread reader state, on its own cache line.
+struct alignas(64) SnapshotReaderRecord {
+    // The epoch the outermost read-side section started in, 0 outside of one.
+    std::atomic<uint64_t> epoch = 0;
+    size_t nesting = 0;
+    std::atomic<bool> in_use = true;
+    SnapshotReaderRecord* next = nullptr;
+};
+
+// The process-wide epoch, reader records and retired references.
+class SnapshotDomain {
+public:
+    // Wait-free once the thread has its record.
+    static void Enter() {
+        SnapshotReaderRecord* record = ThreadRecord();
+        if (record->nesting++ == 0) {
+            record->epoch.store(GetState().epoch.load(std::memory_order_relaxed),
+                                std::memory_order_relaxed);
+            // Pairs with the fence in `Reclaim`: either the writer sees our epoch, or we see the
+            // version it published before retiring the old one.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    static void Leave() {
+        SnapshotReaderRecord* record = ThreadRecord();
+        if (--record->nesting == 0) {
+            record->epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    // Retires one strong reference of `block`, which readers can no longer reach.
+    static void Retire(ControlBlock* block) {
+        State& state = GetState();
+        uint64_t epoch = state.epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+        {
+            std::lock_guard guard(state.mutex);
+            state.retired.emplace_back(block, epoch);
+        }
+        Reclaim();
+    }
+
+    // Drops the retired references whose grace period is over. Returns whether any retired in
+    // `epoch` or earlier are left, counting those another thread is dropping right now.
+    static bool Reclaim(uint64_t epoch = UINT64_MAX) {
+        State& state = GetState();
+        // References retired after this load get a later epoch, so they are never dropped early
+        // even though the list is only looked at after the readers.
+        uint64_t current = state.epoch.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t oldest = std::min(OldestReader(), current);
+
+        std::vector<ControlBlock*> ready;
+        uint64_t first = UINT64_MAX;
+        {
+            std::lock_guard guard(state.mutex);
+            std::erase_if(state.retired, [&](const auto& entry) {
+                if (entry.second > oldest) {
+                    return false;
+                }
+                ready.push_back(entry.first);
+                first = std::min(first, entry.second);
+                return true;
+            });
+            if (!ready.empty()) {
+                state.dropping.push_back(first);
+            }
+        }
+        for (ControlBlock* block : ready) {
+            // May destroy objects that retire references of their own, so not under the lock.
+            block->DecrementStrong();
+        }
+
+        std::lock_guard guard(state.mutex);
+        if (!ready.empty()) {
+            state.dropping.erase(std::find(state.dropping.begin(), state.dropping.end(), first));
+        }
+        auto retired_by = [epoch](uint64_t retired_epoch) { return retired_epoch <= epoch; };
+        return std::any_of(state.retired.begin(), state.retired.end(),
+                           [&](const auto& entry) { return retired_by(entry.second); }) ||
+               std::any_of(state.dropping.begin(), state.dropping.end(), retired_by);
+    }
+
+    // Waits for the grace period of everything retired so far and drops it. References retired
+    // meanwhile are left to later calls, so writers on other threads cannot hold this up. Must
+    // not be called from a read-side section.
+    static void Synchronize() {
+        uint64_t epoch = GetState().epoch.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (OldestReader() < epoch) {
+            std::this_thread::yield();
+        }
+        while (Reclaim(epoch)) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    struct State {
+        std::atomic<uint64_t> epoch = 1;
+        // Records are never freed, only handed over to other threads.
+        std::atomic<SnapshotReaderRecord*> records = nullptr;
+        std::mutex mutex;
+        std::vector<std::pair<ControlBlock*, uint64_t>> retired;
+        // The earliest epoch of each batch being dropped outside of the lock.
+        std::vector<uint64_t> dropping;
+
+        ~State() {
+            // No reader is left at exit.
+            for (auto [block, epoch] : retired) {
+                block->DecrementStrong();
+            }
+        }
+    };
+
+    // Returns the record to the domain when the thread exits.
+    struct ThreadExit {
+        SnapshotReaderRecord* record;
+
+        ~ThreadExit() {
+            if (record != nullptr) {
+                record->in_use.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    static State& GetState() {
+        static State state;
+        return state;
+    }
+
+    // The epoch of the oldest read-side section, UINT64_MAX without one.
+    static uint64_t OldestReader() {
+        uint64_t oldest = UINT64_MAX;
+        for (SnapshotReaderRecord* record = GetState().records.load(std::memory_order_acquire);
+             record != nullptr; record = record->next) {
+            uint64_t epoch = record->epoch.load(std::memory_order_acquire);
+            if (epoch != 0 && epoch < oldest) {
+                oldest = epoch;
+            }
+        }
+        return oldest;
+    }
+
+    static SnapshotReaderRecord* ThreadRecord() {
+        static thread_local ThreadExit thread_exit{nullptr};
+        if (thread_exit.record == nullptr) {
+            thread_exit.record = AcquireRecord();
+        }
+        return thread_exit.record;
+    }
+
+    static SnapshotReaderRecord* AcquireRecord() {
+        State& state = GetState();
+        for (SnapshotReaderRecord* record = state.records.load(std::memory_order_acquire);
+             record != nullptr; record = record->next) {
+            bool in_use = false;
+            if (!record->in_use.load(std::memory_order_relaxed) &&
+                record->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire)) {
+                return record;
+            }
+        }
+        auto record = new SnapshotReaderRecord;
+        record->next = state.records.load(std::memory_order_relaxed);
+        while (!state.records.compare_exchange_weak(record->next, record,
+                                                    std::memory_order_release,
+                                                    std::memory_order_relaxed)) {
+        }
+        return record;
+    }
+};
+
+// A read-side section over one version of a `SnapshotCell`. The version stays alive until the
+// snapshot is destroyed; `Lock()` turns it into an ordinary owner that may outlive the section.
+template <typename T>
+class Snapshot {
+public:
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    ~Snapshot() {
+        SnapshotDomain::Leave();
+    }
+
+    const T* Get() const {
+        return block_ != nullptr ? block_->Get() : nullptr;
+    }
+    const T& operator*() const {
+        return *block_->Get();
+    }
+    const T* operator->() const {
+        return block_->Get();
+    }
+    explicit operator bool() const {
+        return block_ != nullptr;
+    }
+
+    SharedPtr<const T> Lock() const {
+        if (block_ == nullptr) {
+            return SharedPtr<const T>();
+        }
+        block_->IncrementStrong();
+        return SharedPtr<const T>(block_->Get(), static_cast<ControlBlock*>(block_));
+    }
+
+private:
+    ControlBlockObj<T>* block_;
+
+    explicit Snapshot(const std::atomic<ControlBlockObj<T>*>& current) {
+        SnapshotDomain::Enter();
+        block_ = current.load(std::memory_order_acquire);
+    }
+
+    template <typename Y>
+    friend class SnapshotCell;
+};
+
+// Read-mostly data: readers take a `Snapshot` of the current version, writers publish whole new
+// versions. Versions are immutable once published.
+template <typename T>
+class SnapshotCell {
+public:
+    SnapshotCell() = default;
+
+    SnapshotCell(const SnapshotCell&) = delete;
+    SnapshotCell& operator=(const SnapshotCell&) = delete;
+
+    ~SnapshotCell() {
+        if (Block* block = current_.load(std::memory_order_acquire)) {
+            SnapshotDomain::Retire(block);
+        }
+    }
+
+    Snapshot<T> Read() const {
+        return Snapshot<T>(current_);
+    }
+
+    // Makes `T(args...)` the current version.
+    template <typename... Args>
+    void Publish(Args&&... args) {
+        // Always in the block, whatever the size: readers find the version through it.
+        auto next = new Block(std::forward<Args>(args)...);
+        RecordPointerAllocation<T>(sizeof(Block));
+        AtomicCounting::Init(*next);
+        if (Block* old = current_.exchange(next, std::memory_order_acq_rel)) {
+            SnapshotDomain::Retire(old);
+        }
+    }
+
+private:
+    using Block = ControlBlockObj<T>;
+
+    std::atomic<Block*> current_ = nullptr;
+};
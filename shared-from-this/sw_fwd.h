@@ -1,84 +1,892 @@
 #pragma once
 
+#include "../common/allocation_stats.h"
+#include "../common/live_registry.h"
+#include "../unique/compressed_pair.h"
+
+// Define to 1 to allocate control blocks from `SlabAllocator` (slab.h) instead of global `new`.
+// Every translation unit of a program must agree on it.
+#ifndef SHARED_PTR_SLAB_BLOCKS
+#define SHARED_PTR_SLAB_BLOCKS 0
+#endif
+
+#if SHARED_PTR_SLAB_BLOCKS
+#include "slab.h"
+#endif
+
+// Define to 1 to let `RefcountBatchScope` (batch.h) defer strong releases. Every atomic increment
+// and release then looks for an open scope on its thread, so it is off unless asked for. Every
+// translation unit of a program must agree on it.
+#ifndef SHARED_PTR_REFCOUNT_BATCH
+#define SHARED_PTR_REFCOUNT_BATCH 0
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+struct AtomicCounting;
+struct LocalCounting;
+// Defined in biased.h
+struct BiasedCounting;
+
+template <typename T, typename Counting = AtomicCounting>
 class SharedPtr;
 
-template <typename T>
+template <typename T, typename Counting = AtomicCounting>
 class WeakPtr;
 
+// Pointers for graphs that never leave one thread: their counts are updated without atomic
+// read-modify-writes. Converting to and from `SharedPtr`/`WeakPtr` is explicit.
+template <typename T>
+using LocalSharedPtr = SharedPtr<T, LocalCounting>;
+
+template <typename T>
+using LocalWeakPtr = WeakPtr<T, LocalCounting>;
+
+// Whether a `SharedPtr<T>` may share ownership with a pointer to `Y`, as for `std::shared_ptr`.
+// `operator[]` steps by the size of the element type, so arrays do not convert to arrays of bases.
+template <typename Y, typename T>
+concept CompatiblePointer =
+    std::is_convertible_v<Y*, T*> ||
+    (std::is_bounded_array_v<Y> && std::is_convertible_v<std::remove_extent_t<Y> (*)[], T*>);
+
+// Whether a `SharedPtr<T>` may take over a raw `Y*`: for arrays, `Y*` points to the first element.
+template <typename Y, typename T>
+concept OwnablePointer =
+    (std::is_unbounded_array_v<T> && std::is_convertible_v<Y (*)[], T*>) ||
+    (std::is_bounded_array_v<T> && std::is_convertible_v<Y (*)[std::extent_v<T>], T*>) ||
+    (!std::is_array_v<T> && std::is_convertible_v<Y*, T*>);
+
 class EnableSharedFromThisBase;
 
 template <typename T>
 class EnableSharedFromThis;
 
+template <typename T>
+class AtomicSharedPtr;
+
+class RefcountBatchScope;
+
+struct ControlBlock;
+
+// Defined in cycles.h
+class CycleTracer;
+
+// Objects that take part in cycle collection (cycles.h) pass each of their `SharedPtr` members to
+// the tracer.
+template <typename T>
+concept CycleTraceable = requires(T& object, CycleTracer& tracer) { object.Trace(tracer); };
+
+// What a control block does on release, one static table per block type instead of a vtable.
+// `destroy` is null when the object needs no destruction; `dispose` destroys and deallocates in a
+// single call for the common case where no weak reference is left.
+struct ControlBlockOps {
+    void (*destroy)(ControlBlock* block);
+    void (*deallocate)(ControlBlock* block);
+    void (*dispose)(ControlBlock* block);
+    // Null unless the object is `CycleTraceable`.
+    void (*trace)(ControlBlock* block, CycleTracer& tracer);
+#if SMART_PTR_LIVE_REGISTRY
+    const std::type_info* type;
+#endif
+};
+
+// Generates the table of `Block`, which provides `static constexpr bool kTrivialDestroy` and
+// `void Destroy()`, and `void Deallocate()` unless it is allocated with plain `new`.
+template <typename Block>
+struct ControlBlockManager {
+    static void Destroy(ControlBlock* block) {
+        static_cast<Block*>(block)->Destroy();
+    }
+
+    static void Deallocate(ControlBlock* block) {
+        auto self = static_cast<Block*>(block);
+        if constexpr (requires { self->Deallocate(); }) {
+            self->Deallocate();
+        } else {
+            delete self;
+        }
+    }
+
+    static void Dispose(ControlBlock* block) {
+        static_cast<Block*>(block)->Destroy();
+        Deallocate(block);
+    }
+
+    static constexpr bool kTraceable = requires(Block* block, CycleTracer& tracer) {
+        block->Trace(tracer);
+    };
+
+    static void Trace(ControlBlock* block, CycleTracer& tracer) {
+        if constexpr (kTraceable) {
+            static_cast<Block*>(block)->Trace(tracer);
+        }
+    }
+
+    static constexpr ControlBlockOps kOps = {
+        Block::kTrivialDestroy ? nullptr : &Destroy,
+        &Deallocate,
+        Block::kTrivialDestroy ? &Deallocate : &Dispose,
+        kTraceable ? &Trace : nullptr,
+#if SMART_PTR_LIVE_REGISTRY
+        &typeid(Block),
+#endif
+    };
+};
+
+// Blocks of traceable objects that lost a strong reference on this thread and still have others:
+// the candidate roots of garbage cycles, for `CycleCollector` (cycles.h). Each one holds a weak
+// reference, so that the block outlives its object if that goes first.
+class CycleRoots {
+public:
+    // Whether a release of `block` is to buffer it: not while collecting, nor twice.
+    static bool Accepts(ControlBlock* block) {
+        return !suspended && !buffer.blocks.contains(block);
+    }
+
+    // Takes over a weak reference to `block`, which `Accepts`.
+    static void Add(ControlBlock* block) {
+        buffer.blocks.insert(block);
+    }
+
+    // Drops `block` if it is buffered.
+    static void Remove(ControlBlock* block);
+
+    // Buffers `block` again with the weak reference the caller holds, unless it already is.
+    static void Restore(ControlBlock* block);
+
+    // Up to `max` candidates, which now hold the weak references.
+    static std::vector<ControlBlock*> Take(size_t max);
+
+    static size_t Size() {
+        return buffer.blocks.size();
+    }
+
+    // Releases made while set add no candidates.
+    static void SetCollecting(bool collecting) {
+        suspended = collecting;
+    }
+
+private:
+    struct Buffer {
+        std::unordered_set<ControlBlock*> blocks;
+
+        ~Buffer();
+    };
+
+    static inline thread_local Buffer buffer;
+    // Also set once `buffer` is gone, for releases from the destructors of other thread-locals.
+    static inline thread_local bool suspended = false;
+};
+
+// What the release of a strong reference leaves to do.
+enum class StrongRelease {
+    // Other strong references remain.
+    kNone,
+    // The last strong reference is gone: destroy the object, then drop the weak reference the
+    // strong ones held.
+    kObject,
+    // No reference of any kind is left: destroy the object and free the block in one go.
+    kBlock,
+    // Nothing done yet to a block of a traceable object: `ControlBlock::ReleaseTraced` does it.
+    kTraced,
+};
+
+// Both counts share one 64-bit word, strong in the low half and weak in the high half, so that
+// the release of the last strong reference learns from a single read-modify-write whether a weak
+// reference is left. The strong references collectively hold one weak reference: the block is
+// freed exactly once, by whoever drops the weak count to zero. How the counts are updated is
+// decided by the `Counting` policy of the pointer that owns the reference. The table pointer and
+// the word are all there is, 16 bytes like a vtable pointer and two ints.
 struct ControlBlock {
-    int strong = 1;
-    int weak = 0;
+    static constexpr uint64_t kStrongOne = 1;
+    static constexpr uint64_t kWeakOne = uint64_t{1} << 32;
+    // Flags take the top bits of the weak half. `kLocal` is set on blocks created by
+    // `LocalCounting` pointers until one of them is converted to an atomically counted
+    // `SharedPtr`. While it is set every reference lives on the creating thread.
+    static constexpr uint64_t kLocal = uint64_t{1} << 63;
+    // Set for good on blocks of `CycleTraceable` objects, whose releases take the slow path.
+    static constexpr uint64_t kTraced = uint64_t{1} << 62;
+    // Set by `CycleCollector` (cycles.h) on the blocks it walks; a release or revival of one of
+    // them sets `kDirty`. `kDoomed` marks garbage that may no longer be revived.
+    static constexpr uint64_t kWalked = uint64_t{1} << 61;
+    static constexpr uint64_t kDirty = uint64_t{1} << 60;
+    static constexpr uint64_t kDoomed = uint64_t{1} << 59;
+    static constexpr uint64_t kFlags = kLocal | kTraced | kWalked | kDirty | kDoomed;
 
-    virtual void StrongDeleter() = 0;
+    // Blocks of `BiasedCounting` pointers point to a table of their own, which also holds their
+    // biased state (biased.h).
+    const ControlBlockOps* ops;
+    std::atomic<uint64_t> counts;
 
-    virtual ~ControlBlock() = default;
+    explicit ControlBlock(const ControlBlockOps& block_ops)
+        : ops(&block_ops), counts(kStrongOne + kWeakOne + (block_ops.trace ? kTraced : 0)) {
+    }
+
+#if SMART_PTR_LIVE_REGISTRY
+    LiveObject live;
+
+    ~ControlBlock() {
+        LiveRegistry::Remove(&live);
+    }
+
+    // Weak counts leave out the reference the strong ones hold together.
+    template <typename Counting>
+    static LiveCounts LiveCountsOf(const void* object) {
+        auto block = static_cast<const ControlBlock*>(object);
+        size_t strong = Counting::UseCount(*block);
+        size_t weak = Weak(block->counts.load(std::memory_order_relaxed));
+        return {strong, weak - (strong != 0 && weak != 0)};
+    }
+#endif
+
+    // Enters the block in `LiveRegistry` if it is enabled. Called by `Counting::Init`, which
+    // decides how the counts are to be read.
+    template <typename Counting>
+    void Track() {
+#if SMART_PTR_LIVE_REGISTRY
+        LiveRegistry::Add(&live, this, *ops->type, &LiveCountsOf<Counting>);
+#endif
+    }
 
+#if SHARED_PTR_SLAB_BLOCKS
+    // Blocks allocated with `new`, small and not over-aligned, come from the slabs. Blocks that
+    // manage their own memory construct themselves in place.
+    static void* operator new(size_t size) {
+        if (size > SlabAllocator::kMaxSize) {
+            return ::operator new(size);
+        }
+        return SlabAllocator::Allocate(size);
+    }
+
+    static void operator delete(void* block, size_t size) {
+        if (size > SlabAllocator::kMaxSize) {
+            return ::operator delete(block);
+        }
+        SlabAllocator::Deallocate(block, size);
+    }
+
+    static void* operator new(size_t size, std::align_val_t alignment) {
+        return ::operator new(size, alignment);
+    }
+
+    static void operator delete(void* block, std::align_val_t alignment) {
+        ::operator delete(block, alignment);
+    }
+
+    static void* operator new(size_t, void* place) noexcept {
+        return place;
+    }
+
+    static void operator delete(void*, void*) noexcept {
+    }
+#endif
+
+    static uint32_t Strong(uint64_t counts) {
+        return static_cast<uint32_t>(counts);
+    }
+
+    static uint32_t Weak(uint64_t counts) {
+        return static_cast<uint32_t>((counts & ~kFlags) >> 32);
+    }
+
+    bool IsLocal() const {
+        return (counts.load(std::memory_order_relaxed) & kLocal) != 0;
+    }
+
+    // Hands a local block over to atomic counting for good. Only called while every reference
+    // still lives on the creating thread.
+    void EndLocal() {
+        counts.store(counts.load(std::memory_order_relaxed) & ~kLocal, std::memory_order_relaxed);
+    }
+
+    void StrongDeleter() {
+        if (ops->destroy != nullptr) {
+            ops->destroy(this);
+        }
+    }
+
+    template <typename Counting = AtomicCounting>
     void IncrementStrong() {
-        ++strong;
+        Counting::IncrementStrong(*this);
+    }
+
+    // Used by `WeakPtr::Lock()`: never revives an object whose strong count has reached zero.
+    template <typename Counting = AtomicCounting>
+    bool IncrementStrongIfNotZero() {
+        return Counting::IncrementStrongIfNotZero(*this);
     }
 
+    template <typename Counting = AtomicCounting>
     void IncrementWeak() {
-        ++weak;
+        Counting::IncrementWeak(*this);
     }
 
+    template <typename Counting = AtomicCounting>
     void DecrementStrong() {
-        --strong;
-        if (strong == 0 && weak == 0) {
-            StrongDeleter();
-            delete this;
-        } else if (strong == 0) {
-            StrongDeleter();
+        switch (Counting::DecrementStrong(*this)) {
+            case StrongRelease::kNone:
+                return;
+            case StrongRelease::kObject:
+                StrongDeleter();
+                DecrementWeak<Counting>();
+                return;
+            case StrongRelease::kBlock:
+                ops->dispose(this);
+                return;
+            case StrongRelease::kTraced:
+                ReleaseTraced(CycleRoots::Accepts(this));
+                return;
+        }
+    }
+
+    // Releases a strong reference to a traceable object. One that leaves others behind becomes the
+    // weak reference of a candidate root if `buffer`, in the same step: past that, another thread
+    // may free the block. Marks a block that `CycleCollector` is walking as changed. Atomic even
+    // for local blocks, which only their own thread touches.
+    void ReleaseTraced(bool buffer) {
+        uint64_t old = counts.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            next = old - kStrongOne;
+            if ((old & kWalked) != 0) {
+                next |= kDirty;
+            }
+            if (buffer && Strong(old) != 1) {
+                next += kWeakOne;
+            }
+        } while (!counts.compare_exchange_weak(old, next, std::memory_order_acq_rel,
+                                               std::memory_order_relaxed));
+        if (Strong(old) != 1) {
+            if (buffer) {
+                CycleRoots::Add(this);
+            }
+            return;
         }
+        // No cycle through the object is left to look for.
+        CycleRoots::Remove(this);
+        ReleaseObject();
     }
 
+    template <typename Counting = AtomicCounting>
     void DecrementWeak() {
-        --weak;
-        if (strong == 0 && weak == 0) {
-            delete this;
+        // Nobody can make a new weak reference without holding one, so if ours is the only one
+        // left the read-modify-write can be skipped.
+        if (Weak(counts.load(std::memory_order_acquire)) == 1 || Counting::DecrementWeak(*this)) {
+            ops->deallocate(this);
         }
     }
+
+    // For releases that learn the strong count reached zero some other way than from
+    // `Counting::DecrementStrong`.
+    template <typename Counting = AtomicCounting>
+    void ReleaseObject() {
+        if (Weak(counts.load(std::memory_order_acquire)) == 1) {
+            ops->dispose(this);
+            return;
+        }
+        StrongDeleter();
+        DecrementWeak<Counting>();
+    }
+
+    template <typename Counting = AtomicCounting>
+    size_t UseCount() const {
+        return Counting::UseCount(*this);
+    }
+};
+
+#if SHARED_PTR_REFCOUNT_BATCH
+// Strong releases dropped on this thread inside a `RefcountBatchScope` (batch.h) and not yet
+// applied to their blocks. A new strong reference to a block with a pending release takes that
+// release back instead of touching the block: releasing late is always safe, and the pending
+// release keeps the object alive for the new reference.
+class RefcountBatch {
+public:
+    static constexpr size_t kCapacity = 32;
+
+    // The batch of the open scope of this thread, if any.
+    static RefcountBatch* Current() {
+        return current;
+    }
+
+    void Defer(ControlBlock* block) {
+        for (size_t i = 0; i < size_; ++i) {
+            if (entries_[i].block == block) {
+                ++entries_[i].releases;
+                return;
+            }
+        }
+        // Objects destroyed by the flush may fill the log again.
+        while (size_ == kCapacity) {
+            Flush();
+        }
+        entries_[size_++] = {block, 1};
+    }
+
+    // Takes back one pending release of `block`; false if there is none.
+    bool Cancel(ControlBlock* block) {
+        for (size_t i = 0; i < size_; ++i) {
+            if (entries_[i].block == block) {
+                if (--entries_[i].releases == 0) {
+                    entries_[i] = entries_[--size_];
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Applies the pending releases, one read-modify-write per block.
+    void Flush();
+
+private:
+    struct Entry {
+        ControlBlock* block;
+        uint32_t releases;
+    };
+
+    Entry entries_[kCapacity];
+    size_t size_ = 0;
+
+    static inline thread_local RefcountBatch* current = nullptr;
+
+    friend class RefcountBatchScope;
+};
+#endif
+
+// Counting policies. `Init` prepares a freshly created block; `DecrementStrong` says what is left
+// to do and `DecrementWeak` returns true when the weak count drops to zero.
+
+// Thread-safe, with the same orderings as `std::shared_ptr`: a new reference is always made from
+// an existing one, so increments are relaxed; decrements are acq_rel so that the thread that
+// destroys the object sees every write made through the other references.
+struct AtomicCounting {
+    static constexpr bool kLocal = false;
+
+    static void Init(ControlBlock& block) {
+        block.Track<AtomicCounting>();
+    }
+
+    static void IncrementStrong(ControlBlock& block) {
+#if SHARED_PTR_REFCOUNT_BATCH
+        if (RefcountBatch* batch = RefcountBatch::Current(); batch && batch->Cancel(&block)) {
+            return;
+        }
+#endif
+        block.counts.fetch_add(ControlBlock::kStrongOne, std::memory_order_relaxed);
+    }
+
+    static bool IncrementStrongIfNotZero(ControlBlock& block) {
+#if SHARED_PTR_REFCOUNT_BATCH
+        if (RefcountBatch* batch = RefcountBatch::Current(); batch && batch->Cancel(&block)) {
+            return true;
+        }
+#endif
+        uint64_t counts = block.counts.load(std::memory_order_relaxed);
+        while (ControlBlock::Strong(counts) != 0) {
+            uint64_t next = counts + ControlBlock::kStrongOne;
+            if ((counts & ControlBlock::kWalked) != 0) {
+                // Garbage found by `CycleCollector` stays dead; anything else it walks is changed.
+                if ((counts & ControlBlock::kDoomed) != 0) {
+                    return false;
+                }
+                next |= ControlBlock::kDirty;
+            }
+            if (block.counts.compare_exchange_weak(counts, next, std::memory_order_acq_rel,
+                                                   std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static StrongRelease DecrementStrong(ControlBlock& block) {
+#if SHARED_PTR_REFCOUNT_BATCH
+        if (RefcountBatch* batch = RefcountBatch::Current()) {
+            batch->Defer(&block);
+            return StrongRelease::kNone;
+        }
+#endif
+        // The only reference of any kind: nobody else can reach the counts, so one load of the
+        // packed word replaces the read-modify-write.
+        uint64_t counts = block.counts.load(std::memory_order_acquire);
+        if (counts == ControlBlock::kStrongOne + ControlBlock::kWeakOne) {
+            return StrongRelease::kBlock;
+        }
+        if ((counts & ControlBlock::kTraced) != 0) {
+            return StrongRelease::kTraced;
+        }
+        return Released(
+            block.counts.fetch_sub(ControlBlock::kStrongOne, std::memory_order_acq_rel));
+    }
+
+    static void IncrementWeak(ControlBlock& block) {
+        block.counts.fetch_add(ControlBlock::kWeakOne, std::memory_order_relaxed);
+    }
+
+    static bool DecrementWeak(ControlBlock& block) {
+        uint64_t counts = block.counts.fetch_sub(ControlBlock::kWeakOne, std::memory_order_acq_rel);
+        return ControlBlock::Weak(counts) == 1;
+    }
+
+    static size_t UseCount(const ControlBlock& block) {
+        return ControlBlock::Strong(block.counts.load(std::memory_order_relaxed));
+    }
+
+    // `counts` as they were before dropping a strong reference.
+    static StrongRelease Released(uint64_t counts) {
+        if (ControlBlock::Strong(counts) != 1) {
+            return StrongRelease::kNone;
+        }
+        return ControlBlock::Weak(counts) == 1 ? StrongRelease::kBlock : StrongRelease::kObject;
+    }
+};
+
+#if SHARED_PTR_REFCOUNT_BATCH
+inline void RefcountBatch::Flush() {
+    // Destroyed objects may release references of their own, which start a new log.
+    Entry entries[kCapacity];
+    size_t size = std::exchange(size_, 0);
+    std::copy_n(entries_, size, entries);
+    for (size_t i = 0; i < size; ++i) {
+        auto [block, releases] = entries[i];
+        if ((block->counts.load(std::memory_order_relaxed) & ControlBlock::kTraced) != 0) {
+            for (uint32_t j = 0; j < releases; ++j) {
+                block->ReleaseTraced(CycleRoots::Accepts(block));
+            }
+            continue;
+        }
+        uint64_t counts = block->counts.fetch_sub(releases * ControlBlock::kStrongOne,
+                                                  std::memory_order_acq_rel);
+        if (ControlBlock::Strong(counts) == releases) {
+            block->ReleaseObject();
+        }
+    }
+}
+#endif
+
+inline void CycleRoots::Remove(ControlBlock* block) {
+    // Suspended also once `buffer` is gone; a block left in it is dropped when it is taken.
+    if (!suspended && buffer.blocks.erase(block) != 0) {
+        block->DecrementWeak();
+    }
+}
+
+inline void CycleRoots::Restore(ControlBlock* block) {
+    if (suspended || !buffer.blocks.insert(block).second) {
+        block->DecrementWeak();
+    }
+}
+
+inline std::vector<ControlBlock*> CycleRoots::Take(size_t max) {
+    std::vector<ControlBlock*> taken;
+    auto it = buffer.blocks.begin();
+    for (; it != buffer.blocks.end() && taken.size() < max; ++it) {
+        taken.push_back(*it);
+    }
+    buffer.blocks.erase(buffer.blocks.begin(), it);
+    return taken;
+}
+
+inline CycleRoots::Buffer::~Buffer() {
+    suspended = true;
+    for (ControlBlock* block : blocks) {
+        block->DecrementWeak();
+    }
+}
+
+// Plain loads and stores while the block is local; once it has been handed to an atomically
+// counted `SharedPtr` the references may live on several threads and this falls back to
+// `AtomicCounting`.
+struct LocalCounting {
+    static constexpr bool kLocal = true;
+
+    static void Init(ControlBlock& block) {
+        Add(block, ControlBlock::kLocal);
+        block.Track<LocalCounting>();
+    }
+
+    static void IncrementStrong(ControlBlock& block) {
+        if (!block.IsLocal()) {
+            return AtomicCounting::IncrementStrong(block);
+        }
+        Add(block, ControlBlock::kStrongOne);
+    }
+
+    static bool IncrementStrongIfNotZero(ControlBlock& block) {
+        if (!block.IsLocal()) {
+            return AtomicCounting::IncrementStrongIfNotZero(block);
+        }
+        if (ControlBlock::Strong(block.counts.load(std::memory_order_relaxed)) == 0) {
+            return false;
+        }
+        Add(block, ControlBlock::kStrongOne);
+        return true;
+    }
+
+    static StrongRelease DecrementStrong(ControlBlock& block) {
+        uint64_t counts = block.counts.load(std::memory_order_relaxed);
+        if ((counts & ControlBlock::kLocal) == 0) {
+            return AtomicCounting::DecrementStrong(block);
+        }
+        if ((counts & ControlBlock::kTraced) != 0) {
+            return StrongRelease::kTraced;
+        }
+        block.counts.store(counts - ControlBlock::kStrongOne, std::memory_order_relaxed);
+        return AtomicCounting::Released(counts);
+    }
+
+    static void IncrementWeak(ControlBlock& block) {
+        if (!block.IsLocal()) {
+            return AtomicCounting::IncrementWeak(block);
+        }
+        Add(block, ControlBlock::kWeakOne);
+    }
+
+    static bool DecrementWeak(ControlBlock& block) {
+        if (!block.IsLocal()) {
+            return AtomicCounting::DecrementWeak(block);
+        }
+        return ControlBlock::Weak(Add(block, -ControlBlock::kWeakOne)) == 1;
+    }
+
+    static size_t UseCount(const ControlBlock& block) {
+        return ControlBlock::Strong(block.counts.load(std::memory_order_relaxed));
+    }
+
+private:
+    // Returns the counts as they were before.
+    static uint64_t Add(ControlBlock& block, uint64_t delta) {
+        uint64_t counts = block.counts.load(std::memory_order_relaxed);
+        block.counts.store(counts + delta, std::memory_order_relaxed);
+        return counts;
+    }
 };
 
 template <typename T>
 struct ControlBlockPtr : ControlBlock {
+    static constexpr bool kTrivialDestroy = false;
+
     T* ptr;
 
-    ControlBlockPtr(T* pointer) : ptr(pointer) {
+    ControlBlockPtr(T* pointer)
+        : ControlBlock(ControlBlockManager<ControlBlockPtr>::kOps), ptr(pointer) {
     }
 
-    ~ControlBlockPtr() override = default;
-
-    void StrongDeleter() override {
+    void Destroy() {
         delete ptr;
     }
+
+    void Trace(CycleTracer& tracer)
+        requires CycleTraceable<T>
+    {
+        ptr->Trace(tracer);
+    }
 };
 
+// The deleter shares the block with the pointer; stateless deleters take no space.
+template <typename T, typename Deleter>
+struct ControlBlockDeleter : ControlBlock {
+    static constexpr bool kTrivialDestroy = false;
+
+    CompressedPair<T*, Deleter> pair;
+
+    ControlBlockDeleter(T* pointer, Deleter&& deleter)
+        : ControlBlock(ControlBlockManager<ControlBlockDeleter>::kOps),
+          pair(std::move(pointer), std::move(deleter)) {
+    }
+
+    void Destroy() {
+        pair.GetSecond()(pair.GetFirst());
+    }
+
+    // Not for arrays, of which only the first element would be traced.
+    void Trace(CycleTracer& tracer)
+        requires(CycleTraceable<T> && !std::is_same_v<Deleter, std::default_delete<T[]>>)
+    {
+        pair.GetFirst()->Trace(tracer);
+    }
+};
+
+// Asks for a default-initialized object, for the `...ForOverwrite` factories: trivial types are
+// left as allocated instead of zeroed.
+struct ForOverwriteTag {};
+inline constexpr ForOverwriteTag kForOverwrite{};
+
 template <typename T>
 struct ControlBlockObj : ControlBlock {
+    static constexpr bool kTrivialDestroy = std::is_trivially_destructible_v<T>;
+
     alignas(T) char holder[sizeof(T)];
 
     template <typename... Args>
-    ControlBlockObj(Args&&... args) {
+    ControlBlockObj(Args&&... args) : ControlBlock(ControlBlockManager<ControlBlockObj>::kOps) {
         new (&holder) T(std::forward<Args>(args)...);
     }
 
-    ~ControlBlockObj() override = default;
+    explicit ControlBlockObj(ForOverwriteTag)
+        : ControlBlock(ControlBlockManager<ControlBlockObj>::kOps) {
+        new (&holder) T;
+    }
 
-    void StrongDeleter() override {
+    void Destroy() {
         reinterpret_cast<T*>(&holder)->~T();
     }
 
+    void Trace(CycleTracer& tracer)
+        requires CycleTraceable<T>
+    {
+        Get()->Trace(tracer);
+    }
+
     T* Get() {
         return reinterpret_cast<T*>(&holder);
     }
 };
+
+// The block `MakeShared` keeps objects of `Counting` pointers in. A policy with state of its own in
+// every block specializes it to allocate that state together with the object (biased.h).
+template <typename T, typename Counting>
+struct SharedObjectBlock {
+    using Type = ControlBlockObj<T>;
+};
+
+// `MakeShared` keeps objects at least this large out of the block: their storage is freed as soon
+// as the last strong reference goes, while the block waits for the weak ones.
+inline constexpr size_t kSplitStorageThreshold = 4096;
+
+// Uninitialized storage for one `T`.
+template <typename T>
+struct ObjectStorage {
+    alignas(T) char holder[sizeof(T)];
+};
+
+// `ControlBlockObj` allocated through `Allocator` (rebound to the block type), which is kept in
+// the block to free it; stateless allocators take no space.
+template <typename T, typename Allocator>
+struct ControlBlockAlloc : ControlBlock {
+    using BlockAllocator =
+        typename std::allocator_traits<Allocator>::template rebind_alloc<ControlBlockAlloc>;
+    using ObjectAllocator = typename std::allocator_traits<Allocator>::template rebind_alloc<T>;
+
+    static constexpr bool kTrivialDestroy = std::is_trivially_destructible_v<T>;
+
+    CompressedPair<BlockAllocator, ObjectStorage<T>> pair;
+
+    template <typename... Args>
+    ControlBlockAlloc(BlockAllocator allocator, Args&&... args)
+        : ControlBlock(ControlBlockManager<ControlBlockAlloc>::kOps), pair(std::move(allocator)) {
+        ObjectAllocator object_allocator(pair.GetFirst());
+        std::allocator_traits<ObjectAllocator>::construct(object_allocator, Get(),
+                                                          std::forward<Args>(args)...);
+    }
+
+    void Destroy() {
+        ObjectAllocator object_allocator(pair.GetFirst());
+        std::allocator_traits<ObjectAllocator>::destroy(object_allocator, Get());
+    }
+
+    void Trace(CycleTracer& tracer)
+        requires CycleTraceable<T>
+    {
+        Get()->Trace(tracer);
+    }
+
+    void Deallocate() {
+        BlockAllocator allocator(std::move(pair.GetFirst()));
+        this->~ControlBlockAlloc();
+        std::allocator_traits<BlockAllocator>::deallocate(allocator, this, 1);
+    }
+
+    T* Get() {
+        return reinterpret_cast<T*>(&pair.GetSecond().holder);
+    }
+};
+
+// Elements of `MakeShared<T[]>` arrays are aligned to at least a cache line.
+inline constexpr size_t kArrayAlignment = 64;
+
+// `size` objects right after the block, in the same allocation, starting at an `alignment`
+// boundary.
+template <typename T>
+struct ControlBlockArray : ControlBlock {
+    static constexpr bool kTrivialDestroy = std::is_trivially_destructible_v<T>;
+
+    size_t size;
+    size_t alignment;
+
+    // Value-initializes the elements, or default-initializes them `kForOverwrite`; if one of them
+    // throws, the others are destroyed and the memory is freed.
+    template <bool kForOverwrite = false>
+    static ControlBlockArray* Create(size_t size, size_t alignment) {
+        if (!std::has_single_bit(alignment)) {
+            throw std::invalid_argument("Array alignment must be a power of two");
+        }
+        alignment = std::max({alignment, alignof(T), alignof(ControlBlockArray)});
+        size_t offset = Offset(alignment);
+        if (size > (SIZE_MAX - offset) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void* memory = ::operator new(offset + size * sizeof(T), std::align_val_t(alignment));
+        auto block = new (memory) ControlBlockArray(size, alignment);
+        T* elements = block->Get();
+        size_t constructed = 0;
+        try {
+            for (; constructed < size; ++constructed) {
+                if constexpr (kForOverwrite) {
+                    new (elements + constructed) T;
+                } else {
+                    new (elements + constructed) T();
+                }
+            }
+        } catch (...) {
+            std::destroy_n(elements, constructed);
+            ::operator delete(memory, std::align_val_t(alignment));
+            throw;
+        }
+        RecordPointerAllocation<T[]>(offset + size * sizeof(T));
+        return block;
+    }
+
+    // In reverse order of construction, like `delete[]`.
+    void Destroy() {
+        T* elements = Get();
+        for (size_t i = size; i > 0; --i) {
+            elements[i - 1].~T();
+        }
+    }
+
+    void Deallocate() {
+        auto memory_alignment = static_cast<std::align_val_t>(alignment);
+        this->~ControlBlockArray();
+        ::operator delete(this, memory_alignment);
+    }
+
+    T* Get() {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(this) + Offset(alignment));
+    }
+
+private:
+    ControlBlockArray(size_t count, size_t memory_alignment)
+        : ControlBlock(ControlBlockManager<ControlBlockArray>::kOps),
+          size(count),
+          alignment(memory_alignment) {
+    }
+
+    static size_t Offset(size_t alignment) {
+        return (sizeof(ControlBlockArray) + alignment - 1) & ~(alignment - 1);
+    }
+};
@@ -89,3 +89,15 @@ TEST_CASE("WeakFromThis") {
     REQUIRE(!weak.Expired());
     REQUIRE(weak.Lock().Get() == ptr);
 }
+
+TEST_CASE("SharedFromThis of copies") {
+    auto original = MakeShared<T>();
+    auto copy = MakeShared<T>(*original);
+    REQUIRE(copy->SharedFromThis() == copy);
+    REQUIRE(copy->WeakFromThis().Lock().UseCount() == 2);
+
+    T unowned(*original);
+    REQUIRE(unowned.WeakFromThis().Expired());
+    *copy = *original;
+    REQUIRE(copy->SharedFromThis() == copy);
+}
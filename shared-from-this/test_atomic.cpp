@@ -0,0 +1,170 @@
+#include "atomic_shared.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Config {
+    explicit Config(int config_version) : version(config_version) {
+        alive.fetch_add(1);
+    }
+
+    ~Config() {
+        alive.fetch_sub(1);
+    }
+
+    int version;
+
+    inline static std::atomic<int> alive = 0;
+};
+
+}  // namespace
+
+TEST_CASE("AtomicSharedPtr single thread") {
+    static_assert(AtomicSharedPtr<int>::kIsAlwaysLockFree);
+
+    SECTION("Empty") {
+        AtomicSharedPtr<int> atomic;
+        REQUIRE(atomic.Load().Get() == nullptr);
+        atomic.Store(MakeShared<int>(1));
+        atomic.Store(nullptr);
+        REQUIRE(atomic.Load().Get() == nullptr);
+    }
+
+    SECTION("Load and store") {
+        {
+            AtomicSharedPtr<Config> atomic(MakeShared<Config>(1));
+            auto first = atomic.Load();
+            REQUIRE(first->version == 1);
+            REQUIRE(first.UseCount() == 2);
+
+            atomic.Store(MakeShared<Config>(2));
+            REQUIRE(first.UseCount() == 1);
+            REQUIRE(atomic.Load()->version == 2);
+            REQUIRE(Config::alive == 2);
+            first.Reset();
+            REQUIRE(Config::alive == 1);
+        }
+        REQUIRE(Config::alive == 0);
+    }
+
+    SECTION("More loads than prepaid references") {
+        auto config = MakeShared<Config>(1);
+        AtomicSharedPtr<Config> atomic(config);
+        std::vector<SharedPtr<Config>> loaded;
+        for (int i = 0; i < 100'000; ++i) {
+            loaded.push_back(atomic.Load());
+        }
+        REQUIRE(config.UseCount() == 100'002);
+        atomic.Store(nullptr);
+        REQUIRE(config.UseCount() == 100'001);
+        loaded.clear();
+        REQUIRE(config.UseCount() == 1);
+    }
+
+    SECTION("Exchange") {
+        AtomicSharedPtr<Config> atomic(MakeShared<Config>(1));
+        auto old = atomic.Exchange(MakeShared<Config>(2));
+        REQUIRE(old->version == 1);
+        REQUIRE(old.UseCount() == 1);
+        REQUIRE(atomic.Exchange(nullptr)->version == 2);
+        REQUIRE(atomic.Exchange(old).Get() == nullptr);
+    }
+
+    SECTION("CompareExchange") {
+        auto a = MakeShared<Config>(1);
+        auto b = MakeShared<Config>(2);
+        AtomicSharedPtr<Config> atomic(a);
+
+        SharedPtr<Config> expected = b;
+        REQUIRE(!atomic.CompareExchange(expected, b));
+        REQUIRE(expected.Get() == a.Get());
+        REQUIRE(atomic.CompareExchange(expected, b));
+        REQUIRE(atomic.Load().Get() == b.Get());
+        REQUIRE(a.UseCount() == 2);
+
+        // Same address, different owner.
+        SharedPtr<Config> alias(MakeShared<int>(0), b.Get());
+        REQUIRE(!atomic.CompareExchange(alias, a));
+        REQUIRE(alias.Get() == b.Get());
+        REQUIRE(alias.UseCount() == 3);
+
+        SharedPtr<Config> empty;
+        REQUIRE(atomic.CompareExchange(alias, nullptr));
+        REQUIRE(atomic.CompareExchange(empty, a));
+        REQUIRE(atomic.Load().Get() == a.Get());
+    }
+}
+
+TEST_CASE("AtomicSharedPtr concurrent") {
+    constexpr int kNumReaders = 6;
+    constexpr int kNumWriters = 2;
+    constexpr int kNumIterations = 20'000;
+
+    SECTION("Readers see a whole value") {
+        {
+            AtomicSharedPtr<Config> atomic(MakeShared<Config>(0));
+            std::atomic<bool> torn = false;
+            std::vector<std::thread> threads;
+            for (int i = 0; i < kNumReaders; ++i) {
+                threads.emplace_back([&] {
+                    int last = 0;
+                    for (int j = 0; j < kNumIterations; ++j) {
+                        auto config = atomic.Load();
+                        if (config->version < last) {
+                            torn = true;
+                        }
+                        last = config->version;
+                    }
+                });
+            }
+            for (int i = 0; i < kNumWriters; ++i) {
+                threads.emplace_back([&] {
+                    for (int j = 0; j < kNumIterations / 10; ++j) {
+                        // Versions only grow.
+                        auto expected = atomic.Load();
+                        while (!atomic.CompareExchange(
+                            expected, MakeShared<Config>(expected->version + 1))) {
+                        }
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            REQUIRE(!torn);
+            REQUIRE(atomic.Load()->version == kNumWriters * kNumIterations / 10);
+        }
+        REQUIRE(Config::alive == 0);
+    }
+
+    SECTION("Store and Exchange") {
+        {
+            AtomicSharedPtr<Config> atomic;
+            std::vector<std::thread> threads;
+            for (int i = 0; i < kNumReaders; ++i) {
+                threads.emplace_back([&, i] {
+                    for (int j = 0; j < kNumIterations; ++j) {
+                        if (j % 100 == 0) {
+                            atomic.Store(i % 2 == 0 ? MakeShared<Config>(j) : nullptr);
+                        } else if (j % 100 == 50) {
+                            atomic.Exchange(MakeShared<Config>(j));
+                        } else {
+                            auto config = atomic.Load();
+                        }
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+        REQUIRE(Config::alive == 0);
+    }
+}
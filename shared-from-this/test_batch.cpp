@@ -0,0 +1,128 @@
+#include "batch.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Message {
+    explicit Message(int message_id) : id(message_id) {
+        alive.fetch_add(1);
+    }
+
+    ~Message() {
+        alive.fetch_sub(1);
+    }
+
+    int id;
+    SharedPtr<Message> reply;
+
+    inline static std::atomic<int> alive = 0;
+};
+
+}  // namespace
+
+TEST_CASE("Refcount batch") {
+    SECTION("Copies net out") {
+        auto message = MakeShared<Message>(1);
+        {
+            RefcountBatchScope scope;
+            for (int i = 0; i < 100; ++i) {
+                SharedPtr<Message> copy = message;
+                REQUIRE(copy->id == 1);
+            }
+            // The last copy's release is still pending.
+            REQUIRE(message.UseCount() == 2);
+        }
+        REQUIRE(message.UseCount() == 1);
+    }
+
+    SECTION("Objects die at the end of the scope") {
+        WeakPtr<Message> weak;
+        {
+            RefcountBatchScope scope;
+            auto message = MakeShared<Message>(1);
+            weak = message;
+            message.Reset();
+            REQUIRE(Message::alive == 1);
+            REQUIRE(weak.Lock()->id == 1);
+        }
+        REQUIRE(Message::alive == 0);
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Full log is flushed") {
+        {
+            RefcountBatchScope scope;
+            for (size_t i = 0; i < 3 * RefcountBatch::kCapacity; ++i) {
+                MakeShared<Message>(static_cast<int>(i));
+            }
+            REQUIRE(Message::alive <= static_cast<int>(RefcountBatch::kCapacity));
+        }
+        REQUIRE(Message::alive == 0);
+    }
+
+    SECTION("Destructors release references of their own") {
+        {
+            RefcountBatchScope scope;
+            auto message = MakeShared<Message>(1);
+            message->reply = MakeShared<Message>(2);
+            message->reply->reply = MakeShared<Message>(3);
+        }
+        REQUIRE(Message::alive == 0);
+    }
+
+    SECTION("Nested scopes share the log") {
+        auto message = MakeShared<Message>(1);
+        {
+            RefcountBatchScope outer;
+            {
+                RefcountBatchScope inner;
+                SharedPtr<Message> copy = message;
+            }
+            REQUIRE(message.UseCount() == 2);
+        }
+        REQUIRE(message.UseCount() == 1);
+    }
+
+    SECTION("Local pointers are not batched") {
+        auto message = MakeLocalShared<Message>(1);
+        RefcountBatchScope scope;
+        {
+            LocalSharedPtr<Message> copy = message;
+        }
+        REQUIRE(message.UseCount() == 1);
+    }
+}
+
+TEST_CASE("Refcount batch concurrent") {
+    constexpr int kNumThreads = 6;
+    constexpr int kNumIterations = 10'000;
+
+    {
+        auto message = MakeShared<Message>(0);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([message]() mutable {
+                RefcountBatchScope scope;
+                for (int j = 0; j < kNumIterations; ++j) {
+                    SharedPtr<Message> copy = message;
+                    auto fresh = MakeShared<Message>(j);
+                    fresh->reply = copy;
+                }
+                message.Reset();
+            });
+        }
+        message.Reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    REQUIRE(Message::alive == 0);
+}
@@ -0,0 +1,142 @@
+#include "shared.h"
+#include "weak.h"
+#include "biased.h"
+#include "allocations_checker.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Tracked {
+    Tracked() {
+        alive.fetch_add(1);
+    }
+
+    ~Tracked() {
+        alive.fetch_sub(1);
+        destroyed.fetch_add(1);
+    }
+
+    inline static std::atomic<int> alive = 0;
+    inline static std::atomic<int> destroyed = 0;
+};
+
+}  // namespace
+
+TEST_CASE("Biased owner thread") {
+    BiasedWeakPtr<Tracked> weak;
+    {
+        auto a = MakeShared<Tracked, BiasedCounting>();
+        BiasedSharedPtr<Tracked> b = a;
+        BiasedSharedPtr<Tracked> c(new Tracked);
+        weak = b;
+        REQUIRE(a.UseCount() == 2);
+        REQUIRE(weak.Lock().Get() == a.Get());
+        c = a;
+        REQUIRE(a.UseCount() == 3);
+        REQUIRE(Tracked::alive == 1);
+    }
+    REQUIRE(Tracked::alive == 0);
+    REQUIRE(weak.Expired());
+    REQUIRE(weak.Lock().Get() == nullptr);
+}
+
+TEST_CASE("Biased MakeShared allocates once") {
+    // The first biased block of a thread also sets up the thread.
+    MakeShared<Tracked, BiasedCounting>();
+    EXPECT_ONE_ALLOCATION(auto owned = MakeShared<Tracked, BiasedCounting>();
+                          BiasedSharedPtr<Tracked> copy = owned;
+                          REQUIRE(copy.UseCount() == 2));
+    REQUIRE(Tracked::alive == 0);
+}
+
+TEST_CASE("Biased release on another thread") {
+    auto owned = MakeShared<Tracked, BiasedCounting>();
+    BiasedWeakPtr<Tracked> weak(owned);
+
+    SECTION("Counts stay exact") {
+        std::thread([copy = owned] {}).join();
+        REQUIRE(owned.UseCount() == 1);
+        BiasedSharedPtr<Tracked> copy = owned;
+        size_t locked_count = 0;
+        std::thread([&] { locked_count = weak.Lock().UseCount(); }).join();
+        REQUIRE(locked_count == 3);
+        REQUIRE(owned.UseCount() == 2);
+    }
+
+    SECTION("Owner reconciles the queued block") {
+        // The shared count goes negative on the other thread, so the block is queued to us and
+        // the object outlives our last reference until the queue is processed.
+        std::thread([copy = owned] {}).join();
+        owned.Reset();
+        REQUIRE(Tracked::alive == 1);
+        BiasedCounting::ProcessQueue();
+        REQUIRE(Tracked::alive == 0);
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Last reference dropped elsewhere") {
+        BiasedSharedPtr<Tracked> copy = owned;
+        owned.Reset();
+        std::thread([copy = std::move(copy)]() mutable { copy.Reset(); }).join();
+        BiasedCounting::ProcessQueue();
+        REQUIRE(Tracked::alive == 0);
+    }
+}
+
+TEST_CASE("Biased owner exits first") {
+    Tracked::destroyed = 0;
+    std::vector<BiasedSharedPtr<Tracked>> survivors;
+    std::thread([&survivors] {
+        auto owned = MakeShared<Tracked, BiasedCounting>();
+        for (int i = 0; i < 10; ++i) {
+            survivors.push_back(owned);
+        }
+    }).join();
+    REQUIRE(Tracked::alive == 1);
+    REQUIRE(survivors.back().UseCount() == 10);
+    survivors.resize(1);
+    REQUIRE(survivors.back().UseCount() == 1);
+    survivors.clear();
+    REQUIRE(Tracked::alive == 0);
+    REQUIRE(Tracked::destroyed == 1);
+}
+
+TEST_CASE("Biased stress") {
+    Tracked::destroyed = 0;
+    constexpr int kNumRounds = 50;
+    constexpr int kNumThreads = 4;
+    constexpr int kNumCopies = 2000;
+
+    for (int round = 0; round < kNumRounds; ++round) {
+        std::thread owner([] {
+            auto owned = MakeShared<Tracked, BiasedCounting>();
+            BiasedWeakPtr<Tracked> weak(owned);
+            std::vector<std::thread> threads;
+            for (int i = 0; i < kNumThreads; ++i) {
+                threads.emplace_back([copy = owned, weak] {
+                    std::vector<BiasedSharedPtr<Tracked>> copies(kNumCopies, copy);
+                    for (int j = 0; j < kNumCopies; ++j) {
+                        copies.push_back(weak.Lock());
+                    }
+                });
+            }
+            for (int j = 0; j < kNumCopies; ++j) {
+                BiasedSharedPtr<Tracked> copy = owned;
+            }
+            owned.Reset();
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        });
+        owner.join();
+    }
+    REQUIRE(Tracked::alive == 0);
+    REQUIRE(Tracked::destroyed == kNumRounds);
+}
@@ -0,0 +1,247 @@
+#include "cycles.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Vertex {
+    Vertex() {
+        alive.fetch_add(1);
+    }
+
+    ~Vertex() {
+        alive.fetch_sub(1);
+    }
+
+    void Trace(CycleTracer& tracer) {
+        tracer(next);
+        for (auto& edge : edges) {
+            tracer(edge);
+        }
+    }
+
+    SharedPtr<Vertex> next;
+    std::vector<SharedPtr<Vertex>> edges;
+    // Not traced: keeps its object alive like any reference from outside.
+    SharedPtr<int> payload;
+
+    inline static std::atomic<int> alive = 0;
+};
+
+// Not traceable, so never a candidate nor collected.
+struct Plain {
+    SharedPtr<Vertex> vertex;
+};
+
+}  // namespace
+
+TEST_CASE("Cycle collection") {
+    CycleCollector::Collect();
+    REQUIRE(Vertex::alive == 0);
+
+    SECTION("Two objects") {
+        {
+            auto a = MakeShared<Vertex>();
+            auto b = MakeShared<Vertex>();
+            a->next = b;
+            b->next = a;
+        }
+        REQUIRE(Vertex::alive == 2);
+        REQUIRE(CycleCollector::NumCandidates() == 2);
+        REQUIRE(CycleCollector::Collect() == 2);
+        REQUIRE(Vertex::alive == 0);
+        REQUIRE(CycleCollector::NumCandidates() == 0);
+    }
+
+    SECTION("Self loop") {
+        WeakPtr<Vertex> weak;
+        {
+            SharedPtr<Vertex> vertex(new Vertex);
+            vertex->next = vertex;
+            weak = vertex;
+        }
+        REQUIRE(CycleCollector::Collect() == 1);
+        REQUIRE(Vertex::alive == 0);
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Referenced from outside") {
+        auto a = MakeShared<Vertex>();
+        {
+            auto b = MakeShared<Vertex>();
+            auto c = MakeShared<Vertex>();
+            a->next = b;
+            b->next = c;
+            c->next = a;
+        }
+        SharedPtr<Vertex> outside = a->next;
+        a.Reset();
+        REQUIRE(CycleCollector::Collect() == 0);
+        REQUIRE(Vertex::alive == 3);
+        REQUIRE(outside->next->next->next == outside);
+
+        // Now only the cycle's own references are left.
+        outside.Reset();
+        REQUIRE(CycleCollector::Collect() == 3);
+        REQUIRE(Vertex::alive == 0);
+    }
+
+    SECTION("Referenced from an object that is not traced") {
+        Plain plain;
+        {
+            auto a = MakeShared<Vertex>();
+            a->next = MakeShared<Vertex>();
+            a->next->next = a;
+            plain.vertex = a->next;
+        }
+        REQUIRE(CycleCollector::Collect() == 0);
+        REQUIRE(Vertex::alive == 2);
+        plain.vertex.Reset();
+        REQUIRE(CycleCollector::Collect() == 2);
+        REQUIRE(Vertex::alive == 0);
+    }
+
+    SECTION("Garbage hanging off a cycle") {
+        {
+            auto hub = MakeShared<Vertex>();
+            hub->payload = MakeShared<int>(42);
+            for (int i = 0; i < 10; ++i) {
+                auto spoke = MakeShared<Vertex>();
+                spoke->next = hub;
+                hub->edges.push_back(spoke);
+                // A tail that is not part of any cycle.
+                spoke->edges.push_back(MakeShared<Vertex>());
+            }
+        }
+        REQUIRE(Vertex::alive == 21);
+        REQUIRE(CycleCollector::Collect() == 21);
+        REQUIRE(Vertex::alive == 0);
+    }
+
+    SECTION("Alive part of a larger graph") {
+        auto root = MakeShared<Vertex>();
+        {
+            auto a = MakeShared<Vertex>();
+            auto b = MakeShared<Vertex>();
+            a->next = b;
+            b->next = a;
+            // The garbage cycle references the live one, not the other way round.
+            b->edges.push_back(root);
+            root->next = root;
+            root->edges.push_back(MakeShared<Vertex>());
+        }
+        REQUIRE(CycleCollector::Collect() == 2);
+        REQUIRE(Vertex::alive == 2);
+        REQUIRE(root.UseCount() == 2);
+        root->next.Reset();
+        REQUIRE(CycleCollector::Collect() == 0);
+    }
+
+    SECTION("In batches") {
+        constexpr int kNumCycles = 100;
+        for (int i = 0; i < kNumCycles; ++i) {
+            auto a = MakeShared<Vertex>();
+            a->next = MakeShared<Vertex>();
+            a->next->next = a;
+        }
+        REQUIRE(CycleCollector::NumCandidates() == kNumCycles);
+
+        size_t freed = 0;
+        while (CycleCollector::NumCandidates() != 0) {
+            freed += CycleCollector::Collect(10);
+        }
+        REQUIRE(freed == 2 * kNumCycles);
+        REQUIRE(Vertex::alive == 0);
+    }
+
+    CycleCollector::Collect();
+    REQUIRE(Vertex::alive == 0);
+}
+
+TEST_CASE("Cycle candidates per thread") {
+    constexpr int kNumThreads = 4;
+    constexpr int kNumCycles = 1'000;
+
+    std::vector<std::thread> threads;
+    std::atomic<size_t> freed = 0;
+    for (int i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&] {
+            for (int j = 0; j < kNumCycles; ++j) {
+                {
+                    auto a = MakeShared<Vertex>();
+                    a->next = MakeShared<Vertex>();
+                    a->next->next = a;
+                }
+                if (j % 100 == 99) {
+                    freed += CycleCollector::Collect();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(freed == 2 * kNumThreads * kNumCycles);
+    REQUIRE(CycleCollector::NumCandidates() == 0);
+    REQUIRE(Vertex::alive == 0);
+}
+
+TEST_CASE("Cycle collection while other threads use the objects") {
+    constexpr int kRingSize = 64;
+    constexpr int kNumCollections = 10'000;
+
+    CycleCollector::Collect();
+    WeakPtr<Vertex> first;
+    {
+        auto ring = MakeShared<Vertex>();
+        first = ring;
+        SharedPtr<Vertex> last = ring;
+        for (int i = 1; i < kRingSize; ++i) {
+            last->next = MakeShared<Vertex>();
+            last = last->next;
+        }
+        last->next = ring;
+    }
+
+    std::atomic<bool> done = false;
+    std::atomic<int> broken = 0;
+    std::vector<std::thread> threads;
+    // Moves its only reference around the ring, copying each edge before dropping the old one.
+    threads.emplace_back([&, held = first.Lock()]() mutable {
+        while (!done) {
+            held = held->next;
+            broken += !held->next;
+        }
+    });
+    // Now and then revives the ring from a weak pointer.
+    threads.emplace_back([&] {
+        while (!done) {
+            if (auto vertex = first.Lock()) {
+                broken += !vertex->next;
+            }
+            std::this_thread::yield();
+        }
+    });
+    for (int i = 0; i < kNumCollections; ++i) {
+        // Buffers a candidate on this thread.
+        first.Lock().Reset();
+        CycleCollector::Collect();
+    }
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(broken == 0);
+    REQUIRE(Vertex::alive == kRingSize);
+
+    first.Lock().Reset();
+    REQUIRE(CycleCollector::Collect() == kRingSize);
+    REQUIRE(Vertex::alive == 0);
+}
@@ -0,0 +1,110 @@
+#include "hazard.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Route {
+    explicit Route(int route_version) : version(route_version) {
+        alive.fetch_add(1);
+    }
+
+    ~Route() {
+        alive.fetch_sub(1);
+    }
+
+    int version;
+
+    inline static std::atomic<int> alive = 0;
+};
+
+}  // namespace
+
+TEST_CASE("Hazard pointers") {
+    SECTION("Empty") {
+        HazardCell<Route> cell;
+        REQUIRE(!cell.Borrow());
+        REQUIRE(cell.Load().Get() == nullptr);
+    }
+
+    SECTION("Borrow does not count") {
+        auto route = MakeShared<Route>(1);
+        HazardCell<Route> cell(route);
+        REQUIRE(route.UseCount() == 2);
+        auto guard = cell.Borrow();
+        REQUIRE(guard->version == 1);
+        REQUIRE(route.UseCount() == 2);
+        REQUIRE(cell.Load().UseCount() == 3);
+    }
+
+    SECTION("Replaced object outlives its guards") {
+        {
+            HazardCell<Route> cell(MakeShared<Route>(1));
+            {
+                auto guard = cell.Borrow();
+                cell.Store(MakeShared<Route>(2));
+                HazardDomain::Reclaim();
+                REQUIRE(Route::alive == 2);
+                REQUIRE(guard->version == 1);
+                REQUIRE(cell.Borrow()->version == 2);
+            }
+            HazardDomain::Reclaim();
+            REQUIRE(Route::alive == 1);
+            cell.Store(nullptr);
+        }
+        HazardDomain::Reclaim();
+        REQUIRE(Route::alive == 0);
+    }
+
+    SECTION("Other owners keep the object") {
+        auto route = MakeShared<Route>(1);
+        HazardCell<Route> cell(route);
+        cell.Store(nullptr);
+        HazardDomain::Reclaim();
+        REQUIRE(route.UseCount() == 1);
+        REQUIRE(Route::alive == 1);
+    }
+}
+
+TEST_CASE("Hazard pointers concurrent") {
+    constexpr int kNumReaders = 6;
+    constexpr int kNumIterations = 50'000;
+
+    {
+        HazardCell<Route> cell(MakeShared<Route>(0));
+        std::atomic<bool> done = false;
+        std::atomic<bool> torn = false;
+        std::vector<std::thread> readers;
+        for (int i = 0; i < kNumReaders; ++i) {
+            readers.emplace_back([&] {
+                int last = 0;
+                while (!done.load()) {
+                    auto guard = cell.Borrow();
+                    if (guard->version < last) {
+                        torn = true;
+                    }
+                    last = guard->version;
+                    if (cell.Load()->version < last) {
+                        torn = true;
+                    }
+                }
+            });
+        }
+        for (int i = 1; i <= kNumIterations; ++i) {
+            cell.Store(MakeShared<Route>(i));
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        REQUIRE(!torn);
+    }
+    HazardDomain::Reclaim();
+    REQUIRE(Route::alive == 0);
+}
@@ -4,7 +4,12 @@
 
 #include "allocations_checker.h"
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
 #include <memory>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -68,6 +73,35 @@ TEST_CASE("Copy/move") {
     REQUIRE(*end == "delete");
 }
 
+struct ListNode {
+    ListNode() {
+        ++alive;
+    }
+    ~ListNode() {
+        --alive;
+    }
+
+    SharedPtr<ListNode> next;
+
+    static inline int alive = 0;
+};
+
+TEST_CASE("Assignment from an owned pointer") {
+    auto head = MakeShared<ListNode>();
+    head->next = MakeShared<ListNode>();
+    head->next->next = MakeShared<ListNode>();
+
+    // The old object, which owns the new one, goes only once the new one is held.
+    head = head->next;
+    REQUIRE(ListNode::alive == 2);
+    REQUIRE(head->next);
+    head = std::move(head->next);
+    REQUIRE(ListNode::alive == 1);
+    REQUIRE(!head->next);
+    head.Reset();
+    REQUIRE(ListNode::alive == 0);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct ModifiersB {
@@ -333,6 +367,12 @@ TEST_CASE("MakeShared") {
         EXPECT_ONE_ALLOCATION(REQUIRE(*MakeShared<int>(42) == 42));
     }
 
+    SECTION("Compact block") {
+        // Table pointer and packed counts, as small as the vtable pointer and two ints it replaces.
+        static_assert(sizeof(ControlBlock) == 16);
+        static_assert(sizeof(ControlBlockObj<int>) == 24);
+    }
+
     SECTION("Parameters passing") {
         auto p_int = std::make_unique<int>(42);
         Pinned pinned(1312);
@@ -352,6 +392,20 @@ TEST_CASE("MakeShared") {
         } catch (...) {
         }
     }
+
+    SECTION("For overwrite") {
+        SharedPtr<int> p;
+        EXPECT_ONE_ALLOCATION(p = MakeSharedForOverwrite<int>());
+        *p = 42;
+        REQUIRE(*p == 42);
+
+        // Default-initialization still runs constructors.
+        auto data = MakeSharedForOverwrite<std::vector<int>>();
+        REQUIRE(data->empty());
+        auto large = MakeSharedForOverwrite<std::array<char, kSplitStorageThreshold>>();
+        large->fill('x');
+        REQUIRE(large->back() == 'x');
+    }
 }
 
 struct Data {
@@ -467,3 +521,287 @@ TEST_CASE("Destructor for correct type") {
         REQUIRE(B::destructor_called);
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+int deleter_calls = 0;
+
+struct CountingDeleter {
+    void operator()(int* ptr) const {
+        ++deleter_calls;
+        delete ptr;
+    }
+};
+
+struct TaggedDeleter {
+    int* sink;
+    int tag;
+
+    void operator()(int* ptr) const {
+        *sink = tag;
+        delete ptr;
+    }
+};
+
+void FreeInt(int* ptr) {
+    ++deleter_calls;
+    delete ptr;
+}
+
+}  // namespace
+
+TEST_CASE("Custom deleters") {
+    SECTION("Stateless deleters take no space") {
+        static_assert(sizeof(ControlBlockDeleter<int, CountingDeleter>) ==
+                      sizeof(ControlBlockPtr<int>));
+    }
+
+    SECTION("Called once by the last owner") {
+        deleter_calls = 0;
+        {
+            SharedPtr<int> a(new int(42), CountingDeleter{});
+            SharedPtr<int> b = a;
+            a.Reset();
+            REQUIRE(deleter_calls == 0);
+        }
+        REQUIRE(deleter_calls == 1);
+    }
+
+    SECTION("Stateful deleter") {
+        int sink = 0;
+        { SharedPtr<int> a(new int(42), TaggedDeleter{&sink, 7}); }
+        REQUIRE(sink == 7);
+    }
+
+    SECTION("Function pointer and lambda") {
+        deleter_calls = 0;
+        { SharedPtr<int> a(new int(42), &FreeInt); }
+        REQUIRE(deleter_calls == 1);
+
+        int buffer = 0;
+        { SharedPtr<int> b(&buffer, [](int* ptr) { *ptr = 13; }); }
+        REQUIRE(buffer == 13);
+    }
+
+    SECTION("Reset") {
+        deleter_calls = 0;
+        SharedPtr<int> a(new int(42), CountingDeleter{});
+        a.Reset(new int(43), CountingDeleter{});
+        REQUIRE(deleter_calls == 1);
+        REQUIRE(*a == 43);
+        a.Reset(new int(44));
+        REQUIRE(deleter_calls == 2);
+    }
+
+    SECTION("One allocation") {
+        int* ptr = new int(42);
+        EXPECT_ONE_ALLOCATION(SharedPtr<int>(ptr, CountingDeleter{}));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Arena {
+    alignas(std::max_align_t) char buffer[1024];
+    size_t used = 0;
+    int allocations = 0;
+    int deallocations = 0;
+};
+
+// Stateful, not default constructible, given as `ArenaAllocator<char>` and rebound by the block.
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    explicit ArenaAllocator(Arena* arena) : arena(arena) {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {
+    }
+
+    T* allocate(size_t n) {
+        ++arena->allocations;
+        size_t offset = (arena->used + alignof(T) - 1) / alignof(T) * alignof(T);
+        arena->used = offset + n * sizeof(T);
+        return reinterpret_cast<T*>(arena->buffer + offset);
+    }
+
+    void deallocate(T*, size_t) {
+        ++arena->deallocations;
+    }
+
+    Arena* arena;
+};
+
+template <typename T>
+struct MallocAllocator {
+    using value_type = T;
+
+    MallocAllocator() = default;
+
+    template <typename U>
+    MallocAllocator(const MallocAllocator<U>&) {
+    }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(std::malloc(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t) {
+        std::free(ptr);
+    }
+};
+
+}  // namespace
+
+TEST_CASE("AllocateShared") {
+    SECTION("Stateless allocators take no space") {
+        static_assert(sizeof(ControlBlockAlloc<int, MallocAllocator<char>>) ==
+                      sizeof(ControlBlockObj<int>));
+    }
+
+    SECTION("No global allocations") {
+        Arena arena;
+        ArenaAllocator<char> allocator(&arena);
+        EXPECT_ZERO_ALLOCATIONS(auto a = AllocateShared<int>(allocator, 42); auto b = a;
+                                REQUIRE(*b == 42));
+        REQUIRE(arena.allocations == 1);
+        REQUIRE(arena.deallocations == 1);
+
+        MallocAllocator<int> malloc_allocator;
+        EXPECT_ZERO_ALLOCATIONS(AllocateShared<int>(malloc_allocator, 42));
+    }
+
+    SECTION("Lifetime") {
+        Arena arena;
+        {
+            auto a = AllocateShared<std::string>(ArenaAllocator<char>(&arena), "allocated");
+            SharedPtr<const std::string> b = a;
+            REQUIRE(*b == "allocated");
+            REQUIRE(a.UseCount() == 2);
+        }
+        REQUIRE(arena.deallocations == 1);
+    }
+
+    SECTION("Destructor for correct type") {
+        B::destructor_called = false;
+        { SharedPtr<A> ptr = AllocateShared<B>(MallocAllocator<B>()); }
+        REQUIRE(B::destructor_called);
+    }
+}
+
+namespace {
+
+struct Element {
+    Element() : index(constructed++) {
+        if (index == throw_at) {
+            throw 42;
+        }
+    }
+
+    ~Element() {
+        destroyed.push_back(index);
+    }
+
+    int index;
+
+    inline static int constructed = 0;
+    inline static int throw_at = -1;
+    inline static std::vector<int> destroyed;
+};
+
+bool IsAligned(const void* ptr, size_t alignment) {
+    return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+
+}  // namespace
+
+TEST_CASE("Arrays") {
+    SECTION("MakeShared") {
+        SharedPtr<int[]> a;
+        EXPECT_ONE_ALLOCATION(a = MakeShared<int[]>(100));
+        for (int i = 0; i < 100; ++i) {
+            REQUIRE(a[i] == 0);
+            a[i] = i;
+        }
+        REQUIRE(a[99] == 99);
+
+        auto b = MakeShared<double[4]>();
+        b[3] = 1.5;
+        REQUIRE(b.Get()[3] == 1.5);
+        SharedPtr<double[]> c = b;
+        REQUIRE(c.UseCount() == 2);
+        REQUIRE(MakeShared<char[]>(0).Get() != nullptr);
+    }
+
+    SECTION("Alignment") {
+        for (size_t size : {1, 3, 100}) {
+            REQUIRE(IsAligned(MakeShared<char[]>(size).Get(), kArrayAlignment));
+            REQUIRE(IsAligned(MakeSharedAligned<float[]>(size, 256).Get(), 256));
+        }
+        REQUIRE(IsAligned(MakeSharedAligned<int[8]>(4096).Get(), 4096));
+        REQUIRE_THROWS_AS(MakeSharedAligned<int[]>(1, 48), std::invalid_argument);
+    }
+
+    SECTION("Elements are destroyed in reverse order") {
+        Element::constructed = 0;
+        Element::destroyed.clear();
+        { auto a = MakeShared<Element[]>(3); }
+        REQUIRE(Element::destroyed == std::vector<int>{2, 1, 0});
+    }
+
+    SECTION("Faulty constructor") {
+        Element::constructed = 0;
+        Element::throw_at = 2;
+        Element::destroyed.clear();
+        REQUIRE_THROWS(MakeShared<Element[]>(5));
+        REQUIRE(Element::destroyed == std::vector<int>{0, 1});
+        Element::throw_at = -1;
+    }
+
+    SECTION("Aliasing a single element keeps the array alive") {
+        Element::destroyed.clear();
+        SharedPtr<Element> element;
+        {
+            auto a = MakeShared<Element[]>(4);
+            element = SharedPtr<Element>(a, &a[2]);
+        }
+        REQUIRE(Element::destroyed.empty());
+        REQUIRE(element.UseCount() == 1);
+        element.Reset();
+        REQUIRE(Element::destroyed.size() == 4);
+    }
+
+    SECTION("MakeSharedForOverwrite") {
+        SharedPtr<char[]> buffer;
+        EXPECT_ONE_ALLOCATION(buffer = MakeSharedForOverwrite<char[]>(1 << 20));
+        REQUIRE(IsAligned(buffer.Get(), kArrayAlignment));
+        std::fill_n(buffer.Get(), 1 << 20, 'x');
+        REQUIRE(buffer[(1 << 20) - 1] == 'x');
+
+        Element::constructed = 0;
+        Element::destroyed.clear();
+        { auto a = MakeSharedForOverwrite<Element[3]>(); }
+        REQUIRE(Element::destroyed == std::vector<int>{2, 1, 0});
+    }
+
+    SECTION("Pointer from new[]") {
+        SharedPtr<Element[]> a(new Element[2]);
+        a.Reset(new Element[3]);
+        SharedPtr<Element[]> b = a;
+    }
+
+    SECTION("No conversions to arrays of bases") {
+        static_assert(!std::is_constructible_v<SharedPtr<Base[]>, Derived*>);
+        static_assert(!std::is_constructible_v<SharedPtr<Base[2]>, Derived*>);
+        static_assert(!std::is_constructible_v<SharedPtr<Base[]>, SharedPtr<Derived[]>>);
+        static_assert(std::is_constructible_v<SharedPtr<const int[]>, int*>);
+        static_assert(std::is_constructible_v<SharedPtr<int[]>, SharedPtr<int[4]>>);
+        static_assert(std::is_constructible_v<SharedPtr<Base>, Derived*>);
+    }
+}
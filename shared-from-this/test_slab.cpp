@@ -0,0 +1,157 @@
+// Built with SHARED_PTR_SLAB_BLOCKS=1 (see CMakeLists.txt).
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static_assert(SHARED_PTR_SLAB_BLOCKS);
+
+namespace {
+
+struct alignas(64) Aligned {
+    int value = 1;
+};
+
+struct Large {
+    char bytes[SlabAllocator::kMaxSize] = {};
+};
+
+}  // namespace
+
+TEST_CASE("Slab allocator") {
+    SECTION("Blocks are reused") {
+        void* first = SlabAllocator::Allocate(32);
+        SlabAllocator::Deallocate(first, 32);
+        void* second = SlabAllocator::Allocate(32);
+        REQUIRE(second == first);
+        SlabAllocator::Deallocate(second, 32);
+    }
+
+    SECTION("Size classes are apart") {
+        void* small = SlabAllocator::Allocate(16);
+        void* large = SlabAllocator::Allocate(SlabAllocator::kMaxSize);
+        REQUIRE(reinterpret_cast<uintptr_t>(small) % SlabAllocator::kGranularity == 0);
+        REQUIRE(reinterpret_cast<uintptr_t>(large) % SlabAllocator::kGranularity == 0);
+        SlabAllocator::Deallocate(small, 16);
+        SlabAllocator::Deallocate(large, SlabAllocator::kMaxSize);
+    }
+
+    SECTION("Many slabs") {
+        std::vector<void*> blocks;
+        for (size_t i = 0; i < 4 * SlabAllocator::kSlabSize / 48; ++i) {
+            blocks.push_back(SlabAllocator::Allocate(48));
+        }
+        for (void* block : blocks) {
+            SlabAllocator::Deallocate(block, 48);
+        }
+    }
+}
+
+TEST_CASE("Slab control blocks") {
+    SECTION("No allocations in steady state") {
+        MakeShared<int>(0);
+        EXPECT_ZERO_ALLOCATIONS(REQUIRE(*MakeShared<int>(42) == 42));
+        int* ptr = new int(42);
+        EXPECT_ZERO_ALLOCATIONS(SharedPtr<int>{ptr});
+        SharedPtr<int> shared;
+        EXPECT_ONE_ALLOCATION(shared.Reset(new int(43)));
+    }
+
+    SECTION("Weak pointers keep the block") {
+        WeakPtr<std::string> weak;
+        {
+            auto shared = MakeShared<std::string>("slab");
+            weak = shared;
+        }
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Other blocks still work") {
+        auto aligned = MakeShared<Aligned>();
+        REQUIRE(reinterpret_cast<uintptr_t>(aligned.Get()) % 64 == 0);
+        auto large = MakeShared<Large>();
+        REQUIRE(large->bytes[0] == 0);
+        auto array = MakeShared<int[]>(100);
+        REQUIRE(array[99] == 0);
+        SharedPtr<int> with_deleter(new int(1), [](int* ptr) { delete ptr; });
+        REQUIRE(*with_deleter == 1);
+    }
+}
+
+TEST_CASE("Slab control blocks across threads") {
+    constexpr int kNumThreads = 4;
+    constexpr int kNumObjects = 20'000;
+
+    SECTION("Freed on other threads") {
+        std::vector<SharedPtr<int>> objects;
+        for (int i = 0; i < kNumObjects; ++i) {
+            objects.push_back(MakeShared<int>(i));
+        }
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            std::vector<SharedPtr<int>> share;
+            for (int j = i; j < kNumObjects; j += kNumThreads) {
+                share.push_back(std::move(objects[j]));
+            }
+            threads.emplace_back([share = std::move(share)]() mutable { share.clear(); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        // The remote frees are reused here.
+        for (int i = 0; i < kNumObjects; ++i) {
+            objects[i] = MakeShared<int>(i);
+        }
+        REQUIRE(*objects.back() == kNumObjects - 1);
+    }
+
+    SECTION("Outliving the allocating thread") {
+        std::vector<SharedPtr<int>> objects(kNumObjects);
+        std::thread([&] {
+            for (int i = 0; i < kNumObjects; ++i) {
+                objects[i] = MakeShared<int>(i);
+            }
+        }).join();
+        int sum_ok = 0;
+        for (int i = 0; i < kNumObjects; ++i) {
+            sum_ok += *objects[i] == i;
+        }
+        REQUIRE(sum_ok == kNumObjects);
+        objects.clear();
+    }
+
+    SECTION("Concurrent allocation and release") {
+        std::atomic<int> errors = 0;
+        auto shared = MakeShared<int>(7);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kNumThreads; ++i) {
+            threads.emplace_back([&] {
+                std::vector<SharedPtr<int>> local;
+                for (int j = 0; j < kNumObjects; ++j) {
+                    local.push_back(MakeShared<int>(j));
+                    SharedPtr<int> copy = shared;
+                    if (j % 64 == 63) {
+                        for (int k = 0; k < 64; ++k) {
+                            errors += *local[k] != j - 63 + k;
+                        }
+                        local.clear();
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(errors == 0);
+        REQUIRE(shared.UseCount() == 1);
+    }
+}
@@ -0,0 +1,162 @@
+#include "snapshot.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Settings {
+    explicit Settings(int settings_version) : version(settings_version) {
+        alive.fetch_add(1);
+    }
+
+    ~Settings() {
+        alive.fetch_sub(1);
+    }
+
+    int version;
+
+    inline static std::atomic<int> alive = 0;
+};
+
+}  // namespace
+
+TEST_CASE("Snapshot cell") {
+    SECTION("Empty") {
+        SnapshotCell<Settings> cell;
+        auto snapshot = cell.Read();
+        REQUIRE(!snapshot);
+        REQUIRE(snapshot.Lock().Get() == nullptr);
+    }
+
+    SECTION("Old version lives until its readers leave") {
+        {
+            SnapshotCell<Settings> cell;
+            cell.Publish(1);
+            {
+                auto snapshot = cell.Read();
+                cell.Publish(2);
+                REQUIRE(Settings::alive == 2);
+                REQUIRE(snapshot->version == 1);
+                REQUIRE(cell.Read()->version == 2);
+            }
+            SnapshotDomain::Synchronize();
+            REQUIRE(Settings::alive == 1);
+        }
+        SnapshotDomain::Synchronize();
+        REQUIRE(Settings::alive == 0);
+    }
+
+    SECTION("Lock outlives the grace period") {
+        SnapshotCell<Settings> cell;
+        cell.Publish(1);
+        SharedPtr<const Settings> kept = cell.Read().Lock();
+        REQUIRE(kept.UseCount() == 2);
+        cell.Publish(2);
+        SnapshotDomain::Synchronize();
+        REQUIRE(kept->version == 1);
+        REQUIRE(kept.UseCount() == 1);
+        kept.Reset();
+        REQUIRE(Settings::alive == 1);
+    }
+
+    SECTION("Nested sections") {
+        SnapshotCell<Settings> cell;
+        cell.Publish(1);
+        auto outer = cell.Read();
+        cell.Publish(2);
+        {
+            auto inner = cell.Read();
+            REQUIRE(inner->version == 2);
+        }
+        SnapshotDomain::Reclaim();
+        REQUIRE(outer->version == 1);
+        REQUIRE(Settings::alive == 2);
+    }
+}
+
+TEST_CASE("Snapshot cell concurrent") {
+    constexpr int kNumReaders = 6;
+    constexpr int kNumVersions = 20'000;
+
+    {
+        SnapshotCell<Settings> cell;
+        cell.Publish(0);
+        std::atomic<bool> done = false;
+        std::atomic<bool> torn = false;
+        std::vector<std::thread> readers;
+        for (int i = 0; i < kNumReaders; ++i) {
+            readers.emplace_back([&] {
+                int last = 0;
+                while (!done.load()) {
+                    auto snapshot = cell.Read();
+                    if (snapshot->version < last) {
+                        torn = true;
+                    }
+                    last = snapshot->version;
+                    if (last % 100 == 0 && snapshot.Lock()->version != last) {
+                        torn = true;
+                    }
+                }
+            });
+        }
+        for (int i = 1; i <= kNumVersions; ++i) {
+            cell.Publish(i);
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        REQUIRE(!torn);
+    }
+    SnapshotDomain::Synchronize();
+    REQUIRE(Settings::alive == 0);
+}
+
+TEST_CASE("Synchronize while another thread publishes") {
+    constexpr int kNumRounds = 1'000;
+
+    {
+        SnapshotCell<Settings> busy;
+        busy.Publish(0);
+        std::atomic<bool> done = false;
+        // Two writers take turns, each opening its next section before the other leaves its
+        // current one: there is always a reader in the domain and a reference retired after it.
+        std::atomic<int> turn = 0;
+        auto write = [&](int first) {
+            SnapshotDomain::Enter();
+            for (int i = first; !done.load(); i += 2) {
+                while (turn.load() != i && !done.load()) {
+                    std::this_thread::yield();
+                }
+                SnapshotDomain::Leave();
+                SnapshotDomain::Enter();
+                busy.Publish(i);
+                turn.store(i + 1);
+            }
+            SnapshotDomain::Leave();
+        };
+        std::thread first_writer(write, 0);
+        std::thread second_writer(write, 1);
+
+        SnapshotCell<Settings> cell;
+        cell.Publish(0);
+        for (int i = 1; i <= kNumRounds; ++i) {
+            WeakPtr<const Settings> old(cell.Read().Lock());
+            cell.Publish(i);
+            SnapshotDomain::Synchronize();
+            REQUIRE(old.Expired());
+        }
+        done = true;
+        first_writer.join();
+        second_writer.join();
+    }
+    SnapshotDomain::Synchronize();
+    REQUIRE(Settings::alive == 0);
+}
@@ -0,0 +1,140 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Counted {
+    Counted() {
+        alive.fetch_add(1);
+    }
+
+    ~Counted() {
+        alive.fetch_sub(1);
+        destroyed.fetch_add(1);
+    }
+
+    inline static std::atomic<int> alive = 0;
+    inline static std::atomic<int> destroyed = 0;
+};
+
+constexpr int kNumThreads = 8;
+
+template <typename F>
+void RunConcurrently(F&& body) {
+    std::atomic<bool> start = false;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&, i] {
+            while (!start.load()) {
+                std::this_thread::yield();
+            }
+            body(i);
+        });
+    }
+    start.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+}  // namespace
+
+TEST_CASE("Concurrent copies") {
+    Counted::destroyed = 0;
+    constexpr int kNumRounds = 50;
+    constexpr int kNumCopies = 2000;
+
+    for (int round = 0; round < kNumRounds; ++round) {
+        auto shared = MakeShared<Counted>();
+        RunConcurrently([&](int) {
+            std::vector<SharedPtr<Counted>> copies;
+            for (int i = 0; i < kNumCopies; ++i) {
+                copies.push_back(shared);
+            }
+            WeakPtr<Counted> weak(copies.back());
+            for (int i = 0; i < kNumCopies; ++i) {
+                copies.push_back(weak.Lock());
+            }
+        });
+        REQUIRE(shared.UseCount() == 1);
+        REQUIRE(Counted::alive == 1);
+    }
+    REQUIRE(Counted::alive == 0);
+    REQUIRE(Counted::destroyed == kNumRounds);
+}
+
+TEST_CASE("Last release races with Lock") {
+    Counted::destroyed = 0;
+    constexpr int kNumRounds = 2000;
+
+    for (int round = 0; round < kNumRounds; ++round) {
+        std::vector<SharedPtr<Counted>> owners(kNumThreads, SharedPtr<Counted>(new Counted));
+        WeakPtr<Counted> weak(owners[0]);
+        std::atomic<bool> revived = false;
+        RunConcurrently([&](int i) {
+            SharedPtr<Counted> locked = weak.Lock();
+            owners[i].Reset();
+            // The object is never revived after destruction.
+            if (locked && Counted::alive != 1) {
+                revived = true;
+            }
+        });
+        REQUIRE(!revived);
+        REQUIRE(weak.Expired());
+        REQUIRE(weak.Lock().Get() == nullptr);
+    }
+    REQUIRE(Counted::alive == 0);
+    REQUIRE(Counted::destroyed == kNumRounds);
+}
+
+TEST_CASE("Last strong and last weak released concurrently") {
+    Counted::destroyed = 0;
+    constexpr int kNumRounds = 5000;
+
+    for (int round = 0; round < kNumRounds; ++round) {
+        auto shared = MakeShared<Counted>();
+        WeakPtr<Counted> weak(shared);
+        std::thread other([&] { weak.Reset(); });
+        shared.Reset();
+        other.join();
+    }
+    REQUIRE(Counted::alive == 0);
+    REQUIRE(Counted::destroyed == kNumRounds);
+}
+
+TEST_CASE("Local pointer handed to other threads") {
+    Counted::destroyed = 0;
+    constexpr int kNumRounds = 50;
+    constexpr int kNumCopies = 2000;
+
+    for (int round = 0; round < kNumRounds; ++round) {
+        LocalSharedPtr<Counted> local = MakeLocalShared<Counted>();
+        LocalSharedPtr<Counted> local_copy = local;
+        SharedPtr<Counted> shared(local);
+        RunConcurrently([&](int i) {
+            if (i == 0) {
+                // The local copies keep working while the shared ones come and go.
+                for (int j = 0; j < kNumCopies; ++j) {
+                    LocalSharedPtr<Counted> copy = local_copy;
+                }
+                return;
+            }
+            std::vector<SharedPtr<Counted>> copies(kNumCopies, shared);
+            LocalSharedPtr<Counted> thread_local_copy(copies.back());
+            for (int j = 0; j < kNumCopies; ++j) {
+                LocalSharedPtr<Counted> copy = thread_local_copy;
+            }
+        });
+        REQUIRE(local.UseCount() == 3);
+    }
+    REQUIRE(Counted::alive == 0);
+    REQUIRE(Counted::destroyed == kNumRounds);
+}
@@ -7,6 +7,12 @@
 
 #include "allocations_checker.h"
 
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include <unistd.h>
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 TEST_CASE("Empty weak") {
@@ -175,3 +181,125 @@ TEST_CASE("Lifetimes") {
         delete wp;
     }
 }
+
+TEST_CASE("Local counting") {
+    static_assert(!std::is_convertible_v<LocalSharedPtr<int>, SharedPtr<int>>);
+    static_assert(!std::is_convertible_v<SharedPtr<int>, LocalSharedPtr<int>>);
+    static_assert(std::is_constructible_v<SharedPtr<int>, const LocalSharedPtr<int>&>);
+    static_assert(std::is_constructible_v<LocalSharedPtr<int>, const SharedPtr<int>&>);
+
+    SECTION("Lifetimes") {
+        LocalWeakPtr<MyInt> weak;
+        {
+            LocalSharedPtr<MyInt> a = MakeLocalShared<MyInt>(42);
+            LocalSharedPtr<MyInt> b(new MyInt(43));
+            LocalSharedPtr<MyInt> c = a;
+            weak = c;
+            REQUIRE(MyInt::AliveCount() == 2);
+            REQUIRE(a.UseCount() == 2);
+            REQUIRE(*weak.Lock() == 42);
+            b = std::move(c);
+            REQUIRE(MyInt::AliveCount() == 1);
+        }
+        REQUIRE(MyInt::AliveCount() == 0);
+        REQUIRE(weak.Expired());
+        REQUIRE(weak.Lock().Get() == nullptr);
+    }
+
+    SECTION("Conversions share ownership") {
+        auto local = MakeLocalShared<std::string>("local");
+        {
+            SharedPtr<std::string> shared(local);
+            REQUIRE(local.UseCount() == 2);
+            LocalSharedPtr<const std::string> back(shared);
+            REQUIRE(shared.UseCount() == 3);
+            REQUIRE(back.Get() == local.Get());
+        }
+        REQUIRE(local.UseCount() == 1);
+    }
+}
+
+namespace {
+
+// Touches every page, so that the whole object counts towards the resident set.
+struct LargeBuffer {
+    LargeBuffer() {
+        std::memset(bytes, 1, sizeof(bytes));
+    }
+
+    static void* operator new(size_t size) {
+        return ::operator new(size);
+    }
+
+    static void operator delete(void* memory) {
+        ++freed;
+        ::operator delete(memory);
+    }
+
+    char bytes[64 << 20];
+
+    inline static int freed = 0;
+};
+
+// Resident set size of the process, in bytes.
+size_t ResidentBytes() {
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+    if (FILE* statm = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(statm, "%zu %zu", &total_pages, &resident_pages) != 2) {
+            resident_pages = 0;
+        }
+        std::fclose(statm);
+    }
+    return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// Sanitizer allocators keep freed memory in quarantine instead of returning it to the system.
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+constexpr bool kHeapReturnsMemory = false;
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer)
+constexpr bool kHeapReturnsMemory = false;
+#else
+constexpr bool kHeapReturnsMemory = true;
+#endif
+#else
+constexpr bool kHeapReturnsMemory = true;
+#endif
+
+}  // namespace
+
+TEST_CASE("Large objects are freed before their weak pointers") {
+    static_assert(sizeof(LargeBuffer) >= kSplitStorageThreshold);
+
+    SECTION("Storage") {
+        LargeBuffer::freed = 0;
+        WeakPtr<LargeBuffer> weak;
+        {
+            auto shared = MakeShared<LargeBuffer>();
+            weak = shared;
+            REQUIRE(shared->bytes[0] == 1);
+        }
+        REQUIRE(LargeBuffer::freed == 1);
+        REQUIRE(weak.Expired());
+        REQUIRE(weak.Lock().Get() == nullptr);
+    }
+
+    SECTION("Resident set") {
+        size_t before = ResidentBytes();
+        auto shared = MakeShared<LargeBuffer>();
+        WeakPtr<LargeBuffer> weak(shared);
+        size_t peak = ResidentBytes();
+        shared.Reset();
+        size_t after = ResidentBytes();
+        if (kHeapReturnsMemory && before != 0) {
+            REQUIRE(peak - before >= sizeof(LargeBuffer) / 2);
+            REQUIRE(peak - after >= sizeof(LargeBuffer) / 2);
+        }
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Small objects stay in the block") {
+        EXPECT_ONE_ALLOCATION(WeakPtr<std::string>(MakeShared<std::string>("small")));
+    }
+}
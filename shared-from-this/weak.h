@@ -3,7 +3,7 @@
 #include "sw_fwd.h"  // Forward declaration
 
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, typename Counting>
 class WeakPtr {
 public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -13,19 +13,21 @@ public:
 
     WeakPtr(const WeakPtr& other) : ptr_(other.ptr_), block_(other.block_) {
         if (block_ != nullptr) {
-            block_->IncrementWeak();
+            block_->IncrementWeak<Counting>();
         }
     };
 
     template <typename Y>
-    WeakPtr(const WeakPtr<Y>& other) : ptr_(other.ptr_), block_(other.block_) {
+        requires CompatiblePointer<Y, T>
+    WeakPtr(const WeakPtr<Y, Counting>& other) : ptr_(other.ptr_), block_(other.block_) {
         if (block_ != nullptr) {
-            block_->IncrementWeak();
+            block_->IncrementWeak<Counting>();
         }
     };
 
     template <typename Y>
-    WeakPtr(WeakPtr<Y>&& other) : ptr_(other.ptr_), block_(other.block_) {
+        requires CompatiblePointer<Y, T>
+    WeakPtr(WeakPtr<Y, Counting>&& other) : ptr_(other.ptr_), block_(other.block_) {
         other.ptr_ = nullptr;
         other.block_ = nullptr;
     };
@@ -37,9 +39,9 @@ public:
 
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
-    WeakPtr(const SharedPtr<T>& other) : ptr_(other.ptr_), block_(other.block_) {
+    WeakPtr(const SharedPtr<T, Counting>& other) : ptr_(other.ptr_), block_(other.block_) {
         if (block_ != nullptr) {
-            block_->IncrementWeak();
+            block_->IncrementWeak<Counting>();
         }
     };
 
@@ -51,12 +53,12 @@ public:
             return *this;
         }
         if (block_ != nullptr) {
-            block_->DecrementWeak();
+            block_->DecrementWeak<Counting>();
         }
         ptr_ = other.ptr_;
         block_ = other.block_;
         if (block_ != nullptr) {
-            block_->IncrementWeak();
+            block_->IncrementWeak<Counting>();
         }
         return *this;
     };
@@ -65,7 +67,7 @@ public:
             return *this;
         }
         if (block_ != nullptr) {
-            block_->DecrementWeak();
+            block_->DecrementWeak<Counting>();
         }
         ptr_ = other.ptr_;
         block_ = other.block_;
@@ -79,7 +81,7 @@ public:
 
     ~WeakPtr() {
         if (block_ != nullptr) {
-            block_->DecrementWeak();
+            block_->DecrementWeak<Counting>();
         }
     };
 
@@ -88,7 +90,7 @@ public:
 
     void Reset() {
         if (block_ != nullptr) {
-            block_->DecrementWeak();
+            block_->DecrementWeak<Counting>();
         }
         ptr_ = nullptr;
         block_ = nullptr;
@@ -105,26 +107,25 @@ public:
         if (block_ == nullptr) {
             return 0;
         }
-        return block_->strong;
+        return block_->UseCount<Counting>();
     };
     bool Expired() const {
         return UseCount() == 0;
     };
-    SharedPtr<T> Lock() const {
-        if (UseCount() == 0) {
-            return SharedPtr<T>();
+    SharedPtr<T, Counting> Lock() const {
+        if (block_ == nullptr || !block_->IncrementStrongIfNotZero<Counting>()) {
+            return SharedPtr<T, Counting>();
         }
-        block_->IncrementStrong();
-        return SharedPtr<T>(ptr_, block_);
+        return SharedPtr<T, Counting>(ptr_, block_);
     };
 
 private:
-    T* ptr_ = nullptr;
+    std::remove_extent_t<T>* ptr_ = nullptr;
     ControlBlock* block_ = nullptr;
 
     template <typename Y>
     friend class EnableSharedFromThis;
 
-    template <typename Y>
+    template <typename Y, typename OtherCounting>
     friend class WeakPtr;
 };
@@ -55,6 +55,10 @@ struct CompressedPair : private CompressedPairMember<F>, private CompressedPairM
         : CompressedPairMember<F>(std::move(first)), CompressedPairMember<S>(std::move(second)) {
     }
 
+    // Default-initializes the second member.
+    explicit CompressedPair(F&& first) : CompressedPairMember<F>(std::move(first)) {
+    }
+
     F& GetFirst() {
         return CompressedPairMember<F>::Get();
     }
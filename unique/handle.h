@@ -0,0 +1,143 @@
+#pragma once
+
+#include "compressed_pair.h"
+
+#include <concepts>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// What `UniqueHandle` needs to know about a handle type:
+//     using Handle = ...;
+//     Handle Null() const;           // the value that owns nothing
+//     void Close(Handle handle);     // never called with `Null()`
+// Empty traits take no space next to the handle.
+template <typename Traits>
+concept HandleTraits = requires(Traits traits, typename Traits::Handle handle) {
+    { traits.Null() } -> std::convertible_to<typename Traits::Handle>;
+    traits.Close(handle);
+    { handle == handle } -> std::convertible_to<bool>;
+};
+
+// `UniquePtr` for resources that are not pointers: owns a handle value and closes it with the
+// traits.
+template <HandleTraits Traits>
+class UniqueHandle {
+public:
+    using Handle = typename Traits::Handle;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    UniqueHandle() : pair_(Traits{}.Null(), Traits{}) {
+    }
+    explicit UniqueHandle(Handle handle, Traits traits = Traits{})
+        : pair_(std::move(handle), std::move(traits)) {
+    }
+    UniqueHandle(const UniqueHandle&) = delete;
+    UniqueHandle(UniqueHandle&& other) noexcept
+        : pair_(other.Release(), std::move(other.pair_.GetSecond())) {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    UniqueHandle& operator=(const UniqueHandle&) = delete;
+    UniqueHandle& operator=(UniqueHandle&& other) noexcept {
+        if (this != &other) {
+            Reset(other.Release());
+            pair_.GetSecond() = std::move(other.pair_.GetSecond());
+        }
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~UniqueHandle() {
+        Reset();
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    Handle Release() {
+        return std::exchange(pair_.GetFirst(), GetTraits().Null());
+    }
+    void Reset() {
+        Reset(GetTraits().Null());
+    }
+    void Reset(Handle handle) {
+        Handle old_handle = std::exchange(pair_.GetFirst(), std::move(handle));
+        if (!(old_handle == GetTraits().Null())) {
+            GetTraits().Close(old_handle);
+        }
+    }
+    void Swap(UniqueHandle& other) {
+        std::swap(pair_, other.pair_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    const Handle& Get() const {
+        return pair_.GetFirst();
+    }
+    Traits& GetTraits() {
+        return pair_.GetSecond();
+    }
+    const Traits& GetTraits() const {
+        return pair_.GetSecond();
+    }
+    explicit operator bool() const {
+        return !(pair_.GetFirst() == GetTraits().Null());
+    }
+
+private:
+    CompressedPair<Handle, Traits> pair_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// File descriptors
+
+struct FdTraits {
+    using Handle = int;
+
+    int Null() const {
+        return -1;
+    }
+
+    void Close(int fd) const {
+        ::close(fd);
+    }
+};
+
+using UniqueFd = UniqueHandle<FdTraits>;
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Memory mappings
+
+struct MappedRegion {
+    void* address = nullptr;
+    size_t size = 0;
+
+    bool operator==(const MappedRegion&) const = default;
+};
+
+// A failed `mmap` returns `MAP_FAILED`, which must not be adopted.
+struct MmapTraits {
+    using Handle = MappedRegion;
+
+    MappedRegion Null() const {
+        return {};
+    }
+
+    void Close(MappedRegion region) const {
+        ::munmap(region.address, region.size);
+    }
+};
+
+using UniqueMapping = UniqueHandle<MmapTraits>;
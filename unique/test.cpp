@@ -8,6 +8,12 @@
 #include <vector>
 #include <tuple>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <netdb.h>
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct Person {
@@ -421,6 +427,13 @@ void DeleteFunction(T* ptr) {
     delete ptr;
 }
 
+int counted_deletes = 0;
+
+void CountedDelete(int* ptr) {
+    delete ptr;
+    ++counted_deletes;
+}
+
 template <typename T>
 struct StatefulDeleter {
     int some_useless_field = 0;
@@ -462,6 +475,95 @@ TEST_CASE("Compressed pair usage") {
         static_assert(sizeof(UniquePtr<int, decltype(&DeleteFunction<int>)>) ==
                       sizeof(std::pair<int*, decltype(&DeleteFunction<int>)>));
     }
+
+    SECTION("Function as a template parameter") {
+        static_assert(std::is_empty_v<FnDeleter<&DeleteFunction<int>>>);
+        static_assert(sizeof(UniquePtr<int, FnDeleter<&DeleteFunction<int>>>) == sizeof(int*));
+        static_assert(sizeof(UniquePtr<int[], FnDeleter<&free>>) == sizeof(int*));
+        static_assert(sizeof(UniquePtr<FILE, FnDeleter<&fclose>>) == sizeof(FILE*));
+        static_assert(sizeof(UniquePtr<FILE, FnDeleter<&pclose>>) == sizeof(FILE*));
+        static_assert(sizeof(UniquePtr<DIR, FnDeleter<&closedir>>) == sizeof(DIR*));
+        static_assert(sizeof(UniquePtr<addrinfo, FnDeleter<&freeaddrinfo>>) == sizeof(addrinfo*));
+        static_assert(sizeof(UniquePtr<char, FnDeleter<&free>>) == sizeof(char*));
+        // Only for the pointers the function takes.
+        static_assert(std::is_invocable_v<FnDeleter<&fclose>, FILE*>);
+        static_assert(!std::is_invocable_v<FnDeleter<&fclose>, DIR*>);
+        static_assert(std::is_invocable_v<FnDeleter<&free>, int*>);
+    }
+}
+
+TEST_CASE("Function deleters") {
+    SECTION("C API") {
+        UniquePtr<FILE, FnDeleter<&fclose>> file(std::tmpfile());
+        REQUIRE(file);
+        REQUIRE(std::fputs("data", file.Get()) >= 0);
+        UniquePtr<FILE, FnDeleter<&fclose>> moved(std::move(file));
+        REQUIRE(!file);
+        moved.Reset();
+
+        UniquePtr<char, FnDeleter<&free>> buffer(static_cast<char*>(std::malloc(16)));
+        REQUIRE(buffer);
+    }
+
+    SECTION("Called once per object") {
+        counted_deletes = 0;
+        {
+            UniquePtr<int, FnDeleter<&CountedDelete>> first(new int(1));
+            UniquePtr<int, FnDeleter<&CountedDelete>> second(new int(2));
+            first = std::move(second);
+            REQUIRE(counted_deletes == 1);
+            REQUIRE(*first == 2);
+            first.Reset(new int(3));
+            REQUIRE(counted_deletes == 2);
+        }
+        REQUIRE(counted_deletes == 3);
+    }
+}
+
+// Like the standard ones, the factories refuse arrays of known bound.
+template <typename T>
+concept CanMakeUnique = requires { MakeUnique<T>(); };
+
+template <typename T>
+concept CanMakeUniqueForOverwrite = requires { MakeUniqueForOverwrite<T>(); };
+
+TEST_CASE("MakeUnique") {
+    SECTION("Objects") {
+        auto alice = MakeUnique<Alice>();
+        REQUIRE(alice->GetFavoriteNumber() == 37);
+        UniquePtr<Person> person = MakeUnique<Bob>();
+        REQUIRE(person->GetFavoriteNumber() == 43);
+
+        auto pair = MakeUnique<std::pair<int, std::vector<int>>>(1, std::vector<int>{2, 3});
+        REQUIRE(pair->first == 1);
+        REQUIRE(pair->second.size() == 2);
+        REQUIRE(*MakeUnique<int>() == 0);
+    }
+
+    SECTION("Arrays") {
+        auto array = MakeUnique<int[]>(100);
+        for (int i = 0; i < 100; ++i) {
+            REQUIRE(array[i] == 0);
+        }
+        static_assert(std::is_same_v<decltype(array), UniquePtr<int[]>>);
+        static_assert(CanMakeUnique<int>);
+        static_assert(!CanMakeUnique<int[3]>);
+    }
+
+    SECTION("For overwrite") {
+        auto value = MakeUniqueForOverwrite<int>();
+        *value = 42;
+        REQUIRE(*value == 42);
+
+        auto buffer = MakeUniqueForOverwrite<char[]>(1 << 20);
+        std::fill_n(buffer.Get(), 1 << 20, 'x');
+        REQUIRE(buffer[(1 << 20) - 1] == 'x');
+
+        // Default-initialization still runs constructors.
+        auto vectors = MakeUniqueForOverwrite<std::vector<int>[]>(3);
+        REQUIRE(vectors[2].empty());
+        static_assert(!CanMakeUniqueForOverwrite<int[3]>);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,148 @@
+#include "handle.h"
+
+#include <catch.hpp>
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+bool IsOpen(int fd) {
+    return ::fcntl(fd, F_GETFD) != -1;
+}
+
+// `mincore` fails with `ENOMEM` on pages that are not mapped.
+bool IsMapped(void* address) {
+    unsigned char resident;
+    return ::mincore(address, ::getpagesize(), &resident) == 0;
+}
+
+MappedRegion MapAnonymous(size_t size) {
+    void* address =
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    REQUIRE(address != MAP_FAILED);
+    return {address, size};
+}
+
+// Stateful: counts the handles it closes.
+struct CountingTraits {
+    using Handle = int;
+
+    int* closed;
+
+    int Null() const {
+        return 0;
+    }
+
+    void Close(int) {
+        ++*closed;
+    }
+};
+
+}  // namespace
+
+TEST_CASE("Handle size") {
+    static_assert(sizeof(UniqueFd) == sizeof(int));
+    static_assert(sizeof(UniqueMapping) == sizeof(MappedRegion));
+    static_assert(sizeof(UniqueHandle<CountingTraits>) ==
+                  sizeof(std::pair<int, CountingTraits>));
+    static_assert(!std::is_copy_constructible_v<UniqueFd> && !std::is_copy_assignable_v<UniqueFd>);
+    static_assert(std::is_nothrow_move_constructible_v<UniqueFd>);
+    static_assert(std::is_nothrow_move_assignable_v<UniqueFd>);
+}
+
+TEST_CASE("File descriptors") {
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+
+    SECTION("Closed on destruction") {
+        {
+            UniqueFd read_end(fds[0]);
+            UniqueFd write_end(fds[1]);
+            REQUIRE(read_end);
+            REQUIRE(read_end.Get() == fds[0]);
+            REQUIRE(::write(write_end.Get(), "x", 1) == 1);
+            char c;
+            REQUIRE(::read(read_end.Get(), &c, 1) == 1);
+        }
+        REQUIRE(!IsOpen(fds[0]));
+        REQUIRE(!IsOpen(fds[1]));
+    }
+
+    SECTION("Moves") {
+        UniqueFd read_end(fds[0]);
+        UniqueFd write_end(fds[1]);
+        std::vector<UniqueFd> owned;
+        owned.push_back(std::move(read_end));
+        owned.push_back(std::move(write_end));
+        REQUIRE(!read_end);
+        REQUIRE(read_end.Get() == -1);
+
+        UniqueFd other;
+        REQUIRE(!other);
+        other = std::move(owned[0]);
+        REQUIRE(other.Get() == fds[0]);
+        other = std::move(owned[1]);
+        // The read end was closed by the assignment.
+        REQUIRE(!IsOpen(fds[0]));
+        REQUIRE(IsOpen(fds[1]));
+
+        other.Swap(owned[0]);
+        REQUIRE(!other);
+        REQUIRE(owned[0].Get() == fds[1]);
+        owned.clear();
+        REQUIRE(!IsOpen(fds[1]));
+    }
+
+    SECTION("Release and Reset") {
+        UniqueFd fd(fds[0]);
+        REQUIRE(fd.Release() == fds[0]);
+        REQUIRE(!fd);
+        REQUIRE(IsOpen(fds[0]));
+        fd.Reset(fds[0]);
+        fd.Reset(fds[1]);
+        REQUIRE(!IsOpen(fds[0]));
+        fd.Reset();
+        REQUIRE(!IsOpen(fds[1]));
+    }
+}
+
+TEST_CASE("Memory mappings") {
+    size_t size = 4 * ::getpagesize();
+    MappedRegion region = MapAnonymous(size);
+    {
+        UniqueMapping mapping(region);
+        REQUIRE(mapping);
+        REQUIRE(mapping.Get().size == size);
+        std::memset(mapping.Get().address, 42, size);
+
+        UniqueMapping moved(std::move(mapping));
+        REQUIRE(!mapping);
+        REQUIRE(mapping.Get() == MappedRegion{});
+        REQUIRE(static_cast<unsigned char*>(moved.Get().address)[size - 1] == 42);
+        REQUIRE(IsMapped(region.address));
+    }
+    REQUIRE(!IsMapped(region.address));
+}
+
+TEST_CASE("Stateful handle traits") {
+    int closed = 0;
+    {
+        UniqueHandle<CountingTraits> first(1, CountingTraits{&closed});
+        UniqueHandle<CountingTraits> second(2, CountingTraits{&closed});
+        first = std::move(second);
+        REQUIRE(closed == 1);
+        REQUIRE(first.Get() == 2);
+        REQUIRE(first.GetTraits().closed == &closed);
+        // The null value is never closed.
+        first.Reset(0);
+        REQUIRE(closed == 2);
+        first.Reset(3);
+    }
+    REQUIRE(closed == 3);
+}
@@ -2,6 +2,8 @@
 
 #include "compressed_pair.h"
 
+#include "../common/allocation_stats.h"
+
 #include <cstddef>  // std::nullptr_t
 #include <type_traits>
 #include <algorithm>
@@ -30,6 +32,18 @@ struct DefaultDeleter<T[]> {
     }
 };
 
+// Calls `Fn`, fixed at compile time, e.g. `UniquePtr<FILE, FnDeleter<&fclose>>` for a C API.
+// Unlike a function pointer deleter it is empty, so the pointer stays pointer-sized, and the call
+// is direct. Whatever `Fn` returns is ignored.
+template <auto Fn>
+struct FnDeleter {
+    template <typename T>
+        requires std::is_invocable_v<decltype(Fn), T*>
+    void operator()(T* ptr) const {
+        Fn(ptr);
+    }
+};
+
 // Primary template
 template <typename T, typename Deleter = DefaultDeleter<T>>
 class UniquePtr {
@@ -253,3 +267,51 @@ public:
 private:
     CompressedPair<T*, Deleter> pair_;
 };
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Factories
+
+template <typename T, typename... Args>
+    requires(!std::is_array_v<T>)
+UniquePtr<T> MakeUnique(Args&&... args) {
+    UniquePtr<T> ptr(new T(std::forward<Args>(args)...));
+    RecordPointerAllocation<T>(sizeof(T));
+    return ptr;
+}
+
+// `size` value-initialized elements
+template <typename T>
+    requires std::is_unbounded_array_v<T>
+UniquePtr<T> MakeUnique(size_t size) {
+    using Element = std::remove_extent_t<T>;
+    UniquePtr<T> ptr(new Element[size]());
+    RecordPointerAllocation<T>(size * sizeof(Element));
+    return ptr;
+}
+
+template <typename T, typename... Args>
+    requires std::is_bounded_array_v<T>
+void MakeUnique(Args&&...) = delete;
+
+// Default-initialized: trivial types are left as allocated, so large buffers that are about to be
+// overwritten are not zeroed first
+template <typename T>
+    requires(!std::is_array_v<T>)
+UniquePtr<T> MakeUniqueForOverwrite() {
+    UniquePtr<T> ptr(new T);
+    RecordPointerAllocation<T>(sizeof(T));
+    return ptr;
+}
+
+template <typename T>
+    requires std::is_unbounded_array_v<T>
+UniquePtr<T> MakeUniqueForOverwrite(size_t size) {
+    using Element = std::remove_extent_t<T>;
+    UniquePtr<T> ptr(new Element[size]);
+    RecordPointerAllocation<T>(size * sizeof(Element));
+    return ptr;
+}
+
+template <typename T, typename... Args>
+    requires std::is_bounded_array_v<T>
+void MakeUniqueForOverwrite(Args&&...) = delete;